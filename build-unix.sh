@@ -1,3 +1,3 @@
 #!/bin/sh
-c++ -pedantic -O3 '-std=c++11' -c sexpresso/sexpresso.cpp
-ar rcs libsexpresso.a sexpresso.o
+c++ -pedantic -O3 '-std=c++11' -pthread -c sexpresso/sexpresso.cpp sexpresso/sexpresso_binary.cpp sexpresso/sexpresso_image.cpp sexpresso/sexpresso_query.cpp sexpresso/sexpresso_pattern.cpp sexpresso/sexpresso_walk.cpp sexpresso/sexpresso_parallel.cpp sexpresso/sexpresso_shared.cpp sexpresso/sexpresso_diff.cpp sexpresso/sexpresso_positions.cpp sexpresso/sexpresso_store.cpp sexpresso/sexpresso_files.cpp sexpresso/sexpresso_diskcache.cpp sexpresso/sexpresso_parsecache.cpp
+ar rcs libsexpresso.a sexpresso.o sexpresso_binary.o sexpresso_image.o sexpresso_query.o sexpresso_pattern.o sexpresso_walk.o sexpresso_parallel.o sexpresso_shared.o sexpresso_diff.o sexpresso_positions.o sexpresso_store.o sexpresso_files.o sexpresso_diskcache.o sexpresso_parsecache.o
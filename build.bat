@@ -1,7 +1,7 @@
 @echo off
 
-call cl /O2 /c sexpresso\sexpresso.cpp
-call lib sexpresso.obj /OUT:sexpresso.lib
+call cl /O2 /c sexpresso\sexpresso.cpp sexpresso\sexpresso_binary.cpp sexpresso\sexpresso_image.cpp sexpresso\sexpresso_query.cpp sexpresso\sexpresso_pattern.cpp sexpresso\sexpresso_walk.cpp sexpresso\sexpresso_parallel.cpp sexpresso\sexpresso_shared.cpp sexpresso\sexpresso_diff.cpp sexpresso\sexpresso_positions.cpp sexpresso\sexpresso_store.cpp sexpresso\sexpresso_files.cpp sexpresso\sexpresso_diskcache.cpp sexpresso\sexpresso_parsecache.cpp
+call lib sexpresso.obj sexpresso_binary.obj sexpresso_image.obj sexpresso_query.obj sexpresso_pattern.obj sexpresso_walk.obj sexpresso_parallel.obj sexpresso_shared.obj sexpresso_diff.obj sexpresso_positions.obj sexpresso_store.obj sexpresso_files.obj sexpresso_diskcache.obj sexpresso_parsecache.obj /OUT:sexpresso.lib
 call cl /Isexpresso /O2 /c sexpresso_std\sexpresso_std.cpp
 call lib sexpresso_std.obj /OUT:sexpresso_std.lib
 
@@ -1,8 +1,27 @@
 #include <QtTest>
 
 // add necessary includes here
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+#include <atomic>
 #define SEXPRESSO_OPT_OUT_PIKESTYLE
 #include "sexpresso/sexpresso.hpp"
+#include "sexpresso/sexpresso_binary.hpp"
+#include "sexpresso/sexpresso_image.hpp"
+#include "sexpresso/sexpresso_query.hpp"
+#include "sexpresso/sexpresso_pattern.hpp"
+#include "sexpresso/sexpresso_walk.hpp"
+#include "sexpresso/sexpresso_parallel.hpp"
+#include "sexpresso/sexpresso_shared.hpp"
+#include "sexpresso/sexpresso_diff.hpp"
+#include "sexpresso/sexpresso_positions.hpp"
+#include "sexpresso/sexpresso_store.hpp"
+#include "sexpresso/sexpresso_files.hpp"
+#include "sexpresso/sexpresso_diskcache.hpp"
+#include "sexpresso/sexpresso_parsecache.hpp"
 
 class SexpressoTests : public QObject
 {
@@ -59,6 +78,117 @@ private slots:
     void broken_sexp_unclosed_nested_block_comment();
     void char_double_quote();
 
+    // binary serialization
+    void binary_round_trip();
+    void binary_without_positions();
+    void binary_bad_input();
+
+    // canonical s-expressions
+    void canonical_round_trip();
+    void canonical_binary_atoms();
+    void canonical_transport();
+    void canonical_errors();
+
+    // flat tree images
+    void image_query_in_place();
+    void image_map_file();
+    void image_bad_input();
+
+    // source preserving toString
+    void source_string_unmodified();
+    void source_string_after_edit();
+    void source_string_dirty_flag();
+
+    // compiled paths
+    void compiled_path_query();
+    void compiled_path_create();
+
+    // head symbol index
+    void index_path_lookup();
+    void index_kept_up_to_date();
+
+    // queries
+    void query_child_and_descendant();
+    void query_predicates();
+    void query_errors();
+
+    // pattern
+    void pattern_captures();
+    void pattern_guards_and_attributes();
+    void pattern_set_dispatch();
+
+    // batch queries
+    void query_batch_matches_single_queries();
+    void query_batch_shares_prefixes();
+
+    // walks
+    void walk_preorder();
+    void walk_postorder_and_breadth_first();
+    void walk_deep_input();
+
+    // parallel visits
+    void parallel_visit_counts();
+    void parallel_visit_deterministic();
+    void parallel_visit_exception();
+
+    // structural hashing
+    void hash_structural();
+    void hash_strict_equal();
+    void hash_unordered_map_key();
+
+    // shared trees
+    void shared_interning();
+    void shared_round_trip();
+    void shared_collect();
+
+    // diff and patch
+    void diff_round_trip();
+    void diff_edit_kinds();
+    void diff_apply_errors();
+
+    // position index
+    void positions_node_at();
+    void positions_range_and_enclosing();
+
+    // persistent edits
+    void shared_path_copying_edits();
+    void shared_edit_errors();
+
+    // atomic store
+    void store_publish_and_update();
+    void store_concurrent_readers();
+
+    // parsing files
+    void files_parse_async();
+
+    // disk cache
+    void diskcache_warm_restart();
+    void diskcache_stale_entries();
+
+    // parse cache
+    void parsecache_hits_and_evictions();
+    void parsecache_concurrent();
+
+    // feature expressions
+    void feature_expressions();
+    void feature_expression_errors();
+
+    // symbol classification
+    void symbols_classified();
+    void symbols_case_folding();
+
+    // shared structure labels
+    void labels_read_shared();
+    void labels_write_shared();
+
+    // dotted pairs
+    void dotted_pairs();
+    void dotted_pairs_formats();
+
+    // readtable
+    void readtable_macro_characters();
+    void readtable_dispatch();
+
 };
 
 SexpressoTests::SexpressoTests()
@@ -886,6 +1016,1803 @@ void SexpressoTests::char_double_quote()
     QVERIFY(err.length() == 0);
 }
 
+//----------------------------------------------------------------------------
+// binary_round_trip() - does a parse tree survive toBinary()/parseBinary()
+// with every kind, attribute and position intact?
+//----------------------------------------------------------------------------
+void SexpressoTests::binary_round_trip()
+{
+    std::string str = "(defun foo (x) `(print ,@x \"hello\n\" #\\a #x1F #p\"/tmp\")) #(1 2 3) #c(1 2) 'foo foo";
+    std::string err;
+    auto sexp = sexpresso::parse(str,err);
+    QVERIFY(err.length() == 0);
+
+    auto data = sexpresso::toBinary(sexp);
+    auto copy = sexpresso::parseBinary(data,err);
+    QVERIFY(err.length() == 0);
+    QVERIFY(copy.equal(sexp));
+    QVERIFY(copy.toString() == sexp.toString());
+
+    auto& quoted = copy.getChild(0).getChild(3);
+    QVERIFY(quoted.attributes.size() == 1);
+    QVERIFY(quoted.attributes.back() == sexpresso::SexpAttributeKind::BACKQUOTE);
+    QVERIFY(quoted.startpos == sexp.getChild(0).getChild(3).startpos);
+    QVERIFY(quoted.endpos == sexp.getChild(0).getChild(3).endpos);
+    QVERIFY(quoted.getChild(1).attributes.back() == sexpresso::SexpAttributeKind::ATSPLICE);
+    QVERIFY(quoted.getChild(3).atomkind == sexpresso::SexpAtomKind::CHAR);
+    QVERIFY(quoted.getChild(5).atomkind == sexpresso::SexpAtomKind::PATHNAME);
+    QVERIFY(copy.getChild(1).sexpkind == sexpresso::SexpSexpKind::VECTOR);
+    QVERIFY(copy.getChild(2).sexpkind == sexpresso::SexpSexpKind::COMPLEX);
+}
+
+//----------------------------------------------------------------------------
+// binary_without_positions() - positions can be left out of the encoding
+//----------------------------------------------------------------------------
+void SexpressoTests::binary_without_positions()
+{
+    std::string str = "(a (b c) (b c) (b c))";
+    auto sexp = sexpresso::parse(str);
+    auto data = sexpresso::toBinary(sexp, sexpresso::SexpBinaryFlags::NONE);
+    QVERIFY(data.size() < sexpresso::toBinary(sexp).size());
+
+    std::string err;
+    auto copy = sexpresso::parseBinary(data,err);
+    QVERIFY(err.length() == 0);
+    QVERIFY(copy.toString() == str);
+    QVERIFY(copy.getChild(0).getChild(1).startpos == 0);
+}
+
+//----------------------------------------------------------------------------
+// binary_bad_input() - truncated or foreign data reports an error
+//----------------------------------------------------------------------------
+void SexpressoTests::binary_bad_input()
+{
+    std::string err;
+    sexpresso::parseBinary("(not binary)",err);
+    QVERIFY(err == "not a binary sexp");
+
+    auto data = sexpresso::toBinary(sexpresso::parse("(a b c)"));
+    err.clear();
+    sexpresso::parseBinary(data.substr(0, data.size() - 3),err);
+    QVERIFY(err.length() != 0);
+
+    data[4] = 99;
+    err.clear();
+    sexpresso::parseBinary(data,err);
+    QVERIFY(err == "unsupported binary sexp version 99");
+}
+
+//----------------------------------------------------------------------------
+// canonical_round_trip() - toCanonical() length-prefixes every atom and
+// parseCanonical() reads it back
+//----------------------------------------------------------------------------
+void SexpressoTests::canonical_round_trip()
+{
+    auto sexp = sexpresso::parse("(hello (world \"with spaces\") ()) foo");
+    auto canonical = sexp.toCanonical();
+    QVERIFY(canonical == "(5:hello(5:world11:with spaces)())3:foo");
+
+    std::string err;
+    auto copy = sexpresso::parseCanonical(canonical,err);
+    QVERIFY(err.length() == 0);
+    QVERIFY(copy.equal(sexp));
+    QVERIFY(copy.toString() == "(hello (world \"with spaces\") ()) foo");
+    QVERIFY(copy.getChild(0).getChild(1).getChild(1).atomkind == sexpresso::SexpAtomKind::STRING);
+    QVERIFY(copy.getChild(0).getChild(1).getChild(0).atomkind == sexpresso::SexpAtomKind::SYMBOL);
+    QVERIFY(copy.getChild(1).startpos == 34);
+    QVERIFY(copy.getChild(1).endpos == 39);
+
+    QVERIFY(sexp.toCanonical(sexpresso::SexpressoPrintMode::TOP_LEVEL_PARENS) == "(" + canonical + ")");
+}
+
+//----------------------------------------------------------------------------
+// canonical_binary_atoms() - atom bytes are never scanned for delimiters
+//----------------------------------------------------------------------------
+void SexpressoTests::canonical_binary_atoms()
+{
+    std::string payload = std::string{"a)\0(\"b", 6};
+    std::string str = "(4:data" + std::to_string(payload.size()) + ":" + payload + ")";
+    std::string err;
+    auto sexp = sexpresso::parseCanonical(str,err);
+    QVERIFY(err.length() == 0);
+    QVERIFY(sexp.childCount() == 1);
+    QVERIFY(sexp.getChild(0).childCount() == 2);
+    QVERIFY(sexp.getChild(0).getChild(1).value.str == payload);
+    QVERIFY(sexp.toCanonical() == str);
+
+    // display hints are skipped
+    sexp = sexpresso::parseCanonical("[10:text/plain]5:hello",err);
+    QVERIFY(err.length() == 0);
+    QVERIFY(sexp.childCount() == 1);
+    QVERIFY(sexp.getChild(0).value.str == "hello");
+}
+
+//----------------------------------------------------------------------------
+// canonical_transport() - base64 transport blocks
+//----------------------------------------------------------------------------
+void SexpressoTests::canonical_transport()
+{
+    auto sexp = sexpresso::parse("(a (bc def))");
+    auto transport = sexp.toTransport();
+    QVERIFY(transport == "{KDE6YSgyOmJjMzpkZWYpKQ==}");
+
+    std::string err;
+    auto copy = sexpresso::parseCanonical(transport,err);
+    QVERIFY(err.length() == 0);
+    QVERIFY(copy.equal(sexp));
+    QVERIFY(copy.getChild(0).startpos == 0);
+    QVERIFY(copy.getChild(0).endpos == static_cast<int64_t>(transport.size()));
+
+    copy = sexpresso::parseCanonical("(3:foo{KDE6YSgyOmJjMzpkZWYpKQ==})",err);
+    QVERIFY(err.length() == 0);
+    QVERIFY(copy.toString() == "(foo (a (bc def)))");
+}
+
+//----------------------------------------------------------------------------
+// canonical_errors() - malformed canonical input
+//----------------------------------------------------------------------------
+void SexpressoTests::canonical_errors()
+{
+    std::string err;
+    auto sexp = sexpresso::parseCanonical("(3:abc",err);
+    QVERIFY(err == "not enough s-expressions were closed by the end of parsing");
+    QVERIFY(sexp.toString() == "(abc)");
+
+    err.clear();
+    sexpresso::parseCanonical("(10:abc)",err);
+    QVERIFY(err == "atom length exceeds canonical s-expression");
+
+    err.clear();
+    sexpresso::parseCanonical("(abc)",err);
+    QVERIFY(err == "expected a length prefix in canonical s-expression");
+
+    err.clear();
+    sexpresso::parseCanonical("3:abc)",err);
+    QVERIFY(err == "too many ')' characters in canonical s-expression");
+}
+
+//----------------------------------------------------------------------------
+// image_query_in_place() - a SexpView answers the same queries as the Sexp
+// the image was built from
+//----------------------------------------------------------------------------
+void SexpressoTests::image_query_in_place()
+{
+    std::string str = "(myshit (a (name me) (age 2)) (b (name you) 'quoted #(1 2)) just-a-thing)";
+    auto sexp = sexpresso::parse(str);
+
+    sexpresso::SexpImage image;
+    std::string err;
+    QVERIFY(image.load(sexpresso::toImage(sexp),err));
+    auto root = image.root();
+    QVERIFY(root.valid());
+    QVERIFY(root.childCount() == 1);
+
+    auto name = root.getChildByPath("myshit/b/name");
+    QVERIFY(name.valid());
+    QVERIFY(name.childCount() == 2);
+    QVERIFY(name.getChild(1).getString() == "you");
+    QVERIFY(name.startpos() == sexp.getChildByPath("myshit/b/name")->startpos);
+
+    auto atom = root.getChildByPath("myshit/just-a-thing");
+    QVERIFY(atom.valid());
+    QVERIFY(atom.isString());
+    QVERIFY(atom.atomkind() == sexpresso::SexpAtomKind::SYMBOL);
+    QVERIFY(!root.getChildByPath("myshit/c").valid());
+
+    auto b = root.getChildByPath("myshit/b");
+    QVERIFY(b.getChild(2).attributeCount() == 1);
+    QVERIFY(b.getChild(2).attribute(0) == sexpresso::SexpAttributeKind::QUOTE);
+    QVERIFY(b.getChild(3).sexpkind() == sexpresso::SexpSexpKind::VECTOR);
+
+    auto copy = root.toSexp();
+    QVERIFY(copy.equal(sexp));
+    QVERIFY(copy.toString() == str);
+}
+
+//----------------------------------------------------------------------------
+// image_map_file() - images can be mapped straight from disk
+//----------------------------------------------------------------------------
+void SexpressoTests::image_map_file()
+{
+    auto sexp = sexpresso::parse("(config (port 8080) (host \"example.org\"))");
+    std::string path = "sexpresso_image_test.img";
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << sexpresso::toImage(sexp);
+    }
+    sexpresso::SexpImage image;
+    std::string err;
+    QVERIFY(image.map(path,err));
+    auto host = image.root().getChildByPath("config/host");
+    QVERIFY(host.valid());
+    QVERIFY(host.getChild(1).getString() == "example.org");
+    QVERIFY(host.getChild(1).atomkind() == sexpresso::SexpAtomKind::STRING);
+    image.release();
+    std::remove(path.c_str());
+
+    QVERIFY(!image.map(path,err));
+}
+
+//----------------------------------------------------------------------------
+// image_bad_input() - anything that is not a complete image of this byte
+// order is refused, and corrupt child links cannot loop
+//----------------------------------------------------------------------------
+void SexpressoTests::image_bad_input()
+{
+    sexpresso::SexpImage image;
+    std::string err;
+    QVERIFY(!image.load(std::string{"(not an image)"},err));
+    QVERIFY(err == "not a sexp image");
+
+    auto data = sexpresso::toImage(sexpresso::parse("(a b c)"));
+    QVERIFY(!image.load(data.substr(0, data.size() - 1),err));
+    QVERIFY(err == "sexp image sections do not match its size");
+    QVERIFY(!image.root().valid());
+
+    auto swapped = data;
+    std::swap(swapped[6], swapped[7]);
+    QVERIFY(!image.load(swapped,err));
+    QVERIFY(err == "sexp image has the wrong byte order");
+
+    auto quoted = sexpresso::Sexp{"x"};
+    quoted.attributes.assign(UINT16_MAX + 1, sexpresso::SexpAttributeKind::QUOTE);
+    err.clear();
+    QVERIFY(sexpresso::toImage(quoted, err).empty());
+    QVERIFY(err == "too many attributes for a sexp image");
+
+    // a list whose children point back at itself or at its parent
+    auto looped = data;
+    uint64_t first = 1;
+    std::memcpy(&looped[32 + 40 + 8], &first, sizeof(first));
+    QVERIFY(image.load(looped,err));
+    QVERIFY(image.root().getChild(0).childCount() == 0);
+    QVERIFY(image.root().toSexp().toString() == "()");
+    first = 0;
+    std::memcpy(&looped[32 + 8], &first, sizeof(first));
+    QVERIFY(image.load(looped,err));
+    QVERIFY(image.root().childCount() == 0);
+}
+
+//----------------------------------------------------------------------------
+// source_string_unmodified() - an untouched parse tree writes back its source
+// byte for byte, comments and layout included
+//----------------------------------------------------------------------------
+void SexpressoTests::source_string_unmodified()
+{
+    std::string str = "; config\n(server\n  (port   8080) #| old |#\n  (host \"example.org\"))\n";
+    auto sexp = sexpresso::parse(str);
+    QVERIFY(!sexp.dirty);
+    QVERIFY(sexp.toString(str) == str);
+    QVERIFY(sexp.getChild(0).getChild(1).toString(str) == "(port   8080)");
+}
+
+//----------------------------------------------------------------------------
+// source_string_after_edit() - edited lists keep the text between the children
+// they still hold, and only what changed is generated
+//----------------------------------------------------------------------------
+void SexpressoTests::source_string_after_edit()
+{
+    std::string str = "(server\n  (port   8080) ; the port\n  (host \"example.org\")) '(other   stuff)";
+    auto sexp = sexpresso::parse(str);
+    sexp.getChildByPath("server/port")->addChild("8081");
+    QVERIFY(sexp.toString(str) == "(server\n  (port   8080 \"8081\") ; the port\n  (host \"example.org\")) '(other   stuff)");
+
+    sexp.createPath("server/timeout").addChild(sexpresso::Sexp{"30"});
+    QVERIFY(sexp.toString(str) == "(server\n  (port   8080 \"8081\") ; the port\n  (host \"example.org\") (timeout 30)) '(other   stuff)");
+
+    sexp.addChild(sexpresso::Sexp{"tail"});
+    QVERIFY(sexp.toString(str) == "(server\n  (port   8080 \"8081\") ; the port\n  (host \"example.org\") (timeout 30)) '(other   stuff) tail");
+    QVERIFY(sexp.toString(str, sexpresso::SexpressoPrintMode::TOP_LEVEL_PARENS) == "((server\n  (port   8080 \"8081\") ; the port\n  (host \"example.org\") (timeout 30)) '(other   stuff) tail)");
+
+    // text where children were taken out or moved away is not copied back
+    std::string list = "(a ; one\n b   c ; three\n)";
+    auto edited = sexpresso::parse(list);
+    auto& items = edited.getChild(0);
+    items.value.sexp.erase(items.value.sexp.begin() + 1);
+    items.dirty = true;
+    QVERIFY(edited.toString(list) == "(a c ; three\n)");
+    std::swap(items.value.sexp[0], items.value.sexp[1]);
+    QVERIFY(edited.toString(list) == "(c a)");
+
+    std::string pair = "(a  .  b)";
+    auto dotted = sexpresso::parse(pair);
+    dotted.getChild(0).addChild(sexpresso::Sexp{"c"});
+    QVERIFY(dotted.toString(pair) == "(a c . b)");
+}
+
+//----------------------------------------------------------------------------
+// source_string_dirty_flag() - nodes built in code or edited by hand are never
+// copied from the source
+//----------------------------------------------------------------------------
+void SexpressoTests::source_string_dirty_flag()
+{
+    std::string str = "(a   b)   (c   d)";
+    auto sexp = sexpresso::parse(str);
+    QVERIFY(!sexp.getChild(0).dirty);
+
+    sexp.getChild(1).getChild(1).value.str = "e";
+    sexp.getChild(1).getChild(1).dirty = true;
+    QVERIFY(sexp.toString(str) == "(a   b)   (c   e)");
+
+    auto built = sexpresso::Sexp{};
+    built.addChild(sexpresso::Sexp{"x"});
+    QVERIFY(built.dirty);
+    QVERIFY(built.toString(str) == "x");
+
+    // a tree with a parse error still writes back what it can
+    std::string broken = "(a   b) (c";
+    auto partial = sexpresso::parse(broken);
+    QVERIFY(partial.toString(broken) == "(a   b) (c :sexpresso-error)");
+}
+
+//----------------------------------------------------------------------------
+// compiled_path_query() - a SexpPath finds the same nodes as the string path
+//----------------------------------------------------------------------------
+void SexpressoTests::compiled_path_query()
+{
+    using namespace sexpresso::literals;
+    auto s = sexpresso::parse("(myshit (a (name me) (age 2)) (b (name you) (age 1)) just-a-thing)");
+
+    auto path = sexpresso::SexpPath{"myshit/b/name"};
+    QVERIFY(path.segments.size() == 3);
+    QVERIFY(path.segments[1] == "b");
+    QVERIFY(path.hashes.size() == 3);
+    QVERIFY(path.hashes[1] == sexpresso::hashString("b", 1));
+    QVERIFY(s.getChildByPath(path) == s.getChildByPath("myshit/b/name"));
+    QVERIFY(s.getChildByPath(path)->toString() == "name you");
+
+    QVERIFY(s.getChildByPath("myshit/a/age"_path)->toString() == "age 2");
+    QVERIFY(s.getChildByPath("myshit/just-a-thing"_path)->toString() == "just-a-thing");
+    QVERIFY(s.getChildByPath("myshit/c"_path) == nullptr);
+    QVERIFY(s.getChildByPath(sexpresso::SexpPath{std::vector<std::string>{"myshit", "a"}})->toString() == "a (name me) (age 2)");
+}
+
+//----------------------------------------------------------------------------
+// compiled_path_create() - createPath accepts a SexpPath too
+//----------------------------------------------------------------------------
+void SexpressoTests::compiled_path_create()
+{
+    using namespace sexpresso::literals;
+    auto s = sexpresso::Sexp{};
+    auto path = "wow/this/is/cool"_path;
+    auto c = &(s.createPath(path));
+    QVERIFY(s.toString() == "(wow (this (is (cool))))");
+    QVERIFY(c == s.getChildByPath(path));
+    QVERIFY(&(s.createPath(path)) == c);
+}
+
+//----------------------------------------------------------------------------
+// index_path_lookup() - an indexed node answers path queries like an
+// unindexed one
+//----------------------------------------------------------------------------
+void SexpressoTests::index_path_lookup()
+{
+    std::string str = "(config (a 1) (b 2) c (b 3) ((nested) x) () (d (e 4)))";
+    auto plain = sexpresso::parse(str);
+    auto indexed = sexpresso::parse(str);
+    indexed.getChild(0).enableIndex();
+    indexed.getChild(0).getChildByPath("d")->enableIndex();
+
+    for(auto path : {"config/a", "config/b", "config/c", "config/d/e", "config/nested", "config/x", "config/c/d"}) {
+        auto p = plain.getChildByPath(path);
+        auto i = indexed.getChildByPath(path);
+        QVERIFY((p == nullptr) == (i == nullptr));
+        if(p != nullptr) QVERIFY(p->toString() == i->toString());
+    }
+    QVERIFY(indexed.getChildByPath("config/b")->toString() == "b 2");
+    QVERIFY(indexed.getChild(0).index()->count == 8);
+    QVERIFY(indexed.getChild(0).index()->positions.at(sexpresso::hashString("b", 1)).size() == 2);
+    QVERIFY(plain.getChild(0).index() == nullptr);
+    QVERIFY(!plain.getChild(0).extra.ptr);
+}
+
+//----------------------------------------------------------------------------
+// index_kept_up_to_date() - addChild and createPath update the index, copies
+// do not share updates, and dropIndex() goes back to scanning
+//----------------------------------------------------------------------------
+void SexpressoTests::index_kept_up_to_date()
+{
+    auto root = sexpresso::Sexp{};
+    root.enableIndex();
+    for(int i = 0; i < 1000; ++i) {
+        root.createPath("item" + std::to_string(i) + "/value").addChild(sexpresso::Sexp{std::to_string(i)});
+    }
+    QVERIFY(root.index()->count == 1000);
+    QVERIFY(root.getChildByPath("item500/value")->toString() == "value 500");
+
+    auto copy = root;
+    copy.createPath("extra");
+    QVERIFY(copy.getChildByPath("extra") != nullptr);
+    QVERIFY(root.getChildByPath("extra") == nullptr);
+    QVERIFY(root.index()->count == 1000);
+
+    root.value.sexp.erase(root.value.sexp.begin());
+    root.dropIndex();
+    QVERIFY(root.getChildByPath("item0") == nullptr);
+    QVERIFY(root.getChildByPath("item1/value")->toString() == "value 1");
+}
+
+//----------------------------------------------------------------------------
+// query_child_and_descendant() - child steps, // and * in document order
+//----------------------------------------------------------------------------
+void SexpressoTests::query_child_and_descendant()
+{
+    std::string str = "(defun foo (x) (let ((y 1)) (defun inner ()))) (defvar z) (defun bar ())";
+    auto sexp = sexpresso::parse(str);
+
+    auto top = sexpresso::query(sexp, sexpresso::compileQuery("defun")).toVector();
+    QVERIFY(top.size() == 2);
+    QVERIFY(top[0] == &sexp.getChild(0));
+    QVERIFY(top[1] == &sexp.getChild(2));
+
+    auto all = sexpresso::query(sexp, sexpresso::compileQuery("//defun")).toVector();
+    QVERIFY(all.size() == 3);
+    QVERIFY(all[1]->toString() == "defun inner ()");
+
+    auto names = std::vector<std::string>{};
+    for(auto& match : sexpresso::query(sexp, sexpresso::compileQuery("//defun/*[2]"))) {
+        names.push_back(match.toString());
+    }
+    QVERIFY(names.size() == 3);
+    QVERIFY(names[0] == "foo");
+    QVERIFY(names[1] == "inner");
+    QVERIFY(names[2] == "bar");
+
+    auto lets = sexpresso::query(sexp, sexpresso::compileQuery("defun//let//y")).toVector();
+    QVERIFY(lets.size() == 1);
+    QVERIFY(lets[0]->toString() == "y 1");
+}
+
+//----------------------------------------------------------------------------
+// query_predicates() - positional, child, kind and quote attribute predicates
+//----------------------------------------------------------------------------
+void SexpressoTests::query_predicates()
+{
+    std::string str = "(module (pad 1 (layer F.Cu)) (pad 2 (layer B.Cu)) (pad 3 (layer F.Cu))"
+                      " \"text\" '(quoted list) `(back ,x) #(1 2) #xFF)";
+    auto sexp = sexpresso::parse(str);
+
+    auto front = sexpresso::query(sexp, sexpresso::compileQuery("module/pad[layer=F.Cu]")).toVector();
+    QVERIFY(front.size() == 2);
+    QVERIFY(front[1]->getChild(1).value.str == "3");
+
+    auto second = sexpresso::query(sexp, sexpresso::compileQuery("module/pad[layer=F.Cu][2]")).toVector();
+    QVERIFY(second.size() == 1);
+    QVERIFY(second[0] == front[1]);
+
+    QVERIFY(sexpresso::query(sexp, sexpresso::compileQuery("//pad[2]")).toVector().size() == 1);
+    QVERIFY(sexpresso::query(sexp, sexpresso::compileQuery("module[pad]")).toVector().size() == 1);
+    QVERIFY(sexpresso::query(sexp, sexpresso::compileQuery("module[nothing]")).toVector().empty());
+
+    auto strings = sexpresso::query(sexp, sexpresso::compileQuery("//*[:string]")).toVector();
+    QVERIFY(strings.size() == 1);
+    QVERIFY(strings[0]->value.str == "text");
+    QVERIFY(sexpresso::query(sexp, sexpresso::compileQuery("//*[:hex]")).toVector().size() == 1);
+    QVERIFY(sexpresso::query(sexp, sexpresso::compileQuery("//*[:vector]")).toVector().size() == 1);
+
+    auto quoted = sexpresso::query(sexp, sexpresso::compileQuery("//*[@quote]")).toVector();
+    QVERIFY(quoted.size() == 1);
+    QVERIFY(quoted[0]->toString() == "'quoted list");
+    auto commas = sexpresso::query(sexp, sexpresso::compileQuery("//back/*[@comma]")).toVector();
+    QVERIFY(commas.size() == 1);
+    QVERIFY(commas[0]->value.str == "x");
+}
+
+//----------------------------------------------------------------------------
+// query_errors() - malformed queries report an error and match nothing
+//----------------------------------------------------------------------------
+void SexpressoTests::query_errors()
+{
+    std::string err;
+    sexpresso::compileQuery("a//", err);
+    QVERIFY(err == "query ends with '/'");
+    err.clear();
+    sexpresso::compileQuery("a[1", err);
+    QVERIFY(err == "unterminated predicate in query");
+    err.clear();
+    sexpresso::compileQuery("a[@nope]", err);
+    QVERIFY(err == "unknown attribute 'nope' in query");
+    err.clear();
+    sexpresso::compileQuery("a[1][2]", err);
+    QVERIFY(err == "only one positional predicate per query step");
+    err.clear();
+    auto q = sexpresso::compileQuery("a[:nope]", err);
+    QVERIFY(err == "unknown kind 'nope' in query");
+    auto sexp = sexpresso::parse("(a b)");
+    QVERIFY(sexpresso::query(sexp, q).toVector().empty());
+}
+
+//----------------------------------------------------------------------------
+// pattern_captures() - single captures, rest captures and repeated variables
+//----------------------------------------------------------------------------
+void SexpressoTests::pattern_captures()
+{
+    auto sexp = sexpresso::parse("(defun square (x) (print x) (* x x))");
+    auto& form = sexp.getChild(0);
+    sexpresso::SexpMatch match;
+    QVERIFY(sexpresso::matchPattern("(defun ?name ?args . ?body)", form, match));
+    QVERIFY(match.get("name")->first->value.str == "square");
+    QVERIFY(match.get("args")->first->toString() == "x");
+    QVERIFY(match.get("body")->count == 2);
+    QVERIFY(match.get("body")->first[1].toString() == "* x x");
+    QVERIFY(match.get("nothing") == nullptr);
+
+    QVERIFY(sexpresso::matchPattern("(defun ?_ ?_ ...)", form, match));
+    QVERIFY(match.captures.empty());
+    QVERIFY(!sexpresso::matchPattern("(defun ?name ?args)", form, match));
+
+    auto mul = sexpresso::parse("(* x x)").getChild(0);
+    QVERIFY(sexpresso::matchPattern("(* ?a ?a)", mul, match));
+    QVERIFY(match.captures.size() == 1);
+    auto mul2 = sexpresso::parse("(* x y)").getChild(0);
+    QVERIFY(!sexpresso::matchPattern("(* ?a ?a)", mul2, match));
+}
+
+//----------------------------------------------------------------------------
+// pattern_guards_and_attributes() - kind guards and attribute requirements
+//----------------------------------------------------------------------------
+void SexpressoTests::pattern_guards_and_attributes()
+{
+    auto sexp = sexpresso::parse("(load \"init.el\") (load init) '(a b) (a b)");
+    sexpresso::SexpMatch match;
+    QVERIFY(sexpresso::matchPattern("(load ?file:string)", sexp.getChild(0), match));
+    QVERIFY(!sexpresso::matchPattern("(load ?file:string)", sexp.getChild(1), match));
+    QVERIFY(sexpresso::matchPattern("(load ?file:symbol)", sexp.getChild(1), match));
+    QVERIFY(sexpresso::matchPattern("(load ?file:atom)", sexp.getChild(1), match));
+    QVERIFY(!sexpresso::matchPattern("(load ?file:list)", sexp.getChild(1), match));
+
+    QVERIFY(sexpresso::matchPattern("'(a ?x)", sexp.getChild(2), match));
+    QVERIFY(!sexpresso::matchPattern("'(a ?x)", sexp.getChild(3), match));
+    QVERIFY(sexpresso::matchPattern("(a ?x)", sexp.getChild(2), match));
+
+    sexpresso::SexpPatternSet set;
+    std::string err;
+    QVERIFY(set.add("(load ?file:nope)", err) == SIZE_MAX);
+    QVERIFY(err == "unknown guard in pattern variable ?file:nope");
+    err.clear();
+    QVERIFY(set.add("(a) (b)", err) == SIZE_MAX);
+    QVERIFY(err == "a pattern must be exactly one s-expression");
+    QVERIFY(set.size() == 0);
+}
+
+//----------------------------------------------------------------------------
+// pattern_set_dispatch() - one walk reports every matching pattern in id order
+//----------------------------------------------------------------------------
+void SexpressoTests::pattern_set_dispatch()
+{
+    sexpresso::SexpPatternSet set;
+    std::string err;
+    auto generic = set.add("(?op ?a ?b)", err);
+    auto plus = set.add("(+ ?a ?b)", err);
+    auto plusone = set.add("(+ ?a 1)", err);
+    auto minus = set.add("(- ?a ?b)", err);
+    QVERIFY(err.empty());
+    QVERIFY(set.size() == 4);
+
+    auto sexp = sexpresso::parse("(+ n 1)");
+    auto matches = set.match(sexp.getChild(0));
+    QVERIFY(matches.size() == 3);
+    QVERIFY(matches[0].pattern == generic);
+    QVERIFY(matches[1].pattern == plus);
+    QVERIFY(matches[2].pattern == plusone);
+    QVERIFY(matches[2].get("a")->first->value.str == "n");
+    QVERIFY(matches[1].get("b")->first->value.str == "1");
+
+    sexp = sexpresso::parse("(- n 1)");
+    matches = set.match(sexp.getChild(0));
+    QVERIFY(matches.size() == 2);
+    QVERIFY(matches[1].pattern == minus);
+
+    sexp = sexpresso::parse("(- n 1 2)");
+    QVERIFY(set.match(sexp.getChild(0)).empty());
+}
+
+//----------------------------------------------------------------------------
+// query_batch_matches_single_queries() - a batch reports exactly what each
+// query finds on its own, in document order
+//----------------------------------------------------------------------------
+void SexpressoTests::query_batch_matches_single_queries()
+{
+    std::string str = "(defun foo (x) (let ((y 1)) (defun inner () 'y))) (defvar z) "
+                      "(defun bar (b b) (b 1) (b 2)) (b 3) (\"s\" \"t\")";
+    auto sexp = sexpresso::parse(str);
+    auto queries = std::vector<std::string>{
+        "defun", "//defun", "//defun/*[2]", "defun//let//y", "//b", "//b[2]", "//b[2]/*",
+        "//*[:string]", "//*[@quote]", "defun/b", "defun/b[1]", "//defun[let]", "//nothing"
+    };
+    auto batch = sexpresso::SexpQueryBatch{};
+    auto found = std::vector<std::vector<sexpresso::Sexp*>>(queries.size());
+    for(size_t i = 0; i < queries.size(); ++i) {
+        auto id = batch.add(sexpresso::compileQuery(queries[i]), [&found, i](sexpresso::Sexp& match) { found[i].push_back(&match); });
+        QVERIFY(id == i);
+    }
+    QVERIFY(batch.size() == queries.size());
+    batch.run(sexp);
+    for(size_t i = 0; i < queries.size(); ++i) {
+        auto expected = sexpresso::query(sexp, sexpresso::compileQuery(queries[i])).toVector();
+        QVERIFY(found[i] == expected);
+    }
+    QVERIFY(found[0].size() == 2);
+    QVERIFY(found[12].empty());
+
+    // a batch can be run again on another tree
+    for(auto& f : found) f.clear();
+    auto other = sexpresso::parse("(defun baz ())");
+    batch.run(other);
+    QVERIFY(found[0].size() == 1);
+    QVERIFY(found[2].size() == 1);
+    QVERIFY(found[2][0]->value.str == "baz");
+}
+
+//----------------------------------------------------------------------------
+// query_batch_shares_prefixes() - queries with common leading steps share
+// nodes in the batch's step trie
+//----------------------------------------------------------------------------
+void SexpressoTests::query_batch_shares_prefixes()
+{
+    auto batch = sexpresso::SexpQueryBatch{};
+    auto count = size_t{0};
+    auto callback = [&count](sexpresso::Sexp&) { ++count; };
+    batch.add(sexpresso::compileQuery("module/pad/at"), callback);
+    batch.add(sexpresso::compileQuery("module/pad/size"), callback);
+    batch.add(sexpresso::compileQuery("module/pad"), callback);
+    batch.add(sexpresso::compileQuery("module/layer"), callback);
+    QVERIFY(batch.nodes.size() == 6); // root, module, pad, at, size, layer
+
+    auto sexp = sexpresso::parse("(module (layer F.Cu) (pad 1 (at 0 0) (size 1 1)) (pad 2 (at 1 0)))");
+    batch.run(sexp);
+    QVERIFY(count == 6);
+}
+
+//----------------------------------------------------------------------------
+// walk_preorder() - document order with depth, parent and child index, and
+// subtree skipping
+//----------------------------------------------------------------------------
+void SexpressoTests::walk_preorder()
+{
+    auto sexp = sexpresso::parse("(a (b c) d) e");
+    auto walk = sexpresso::preorder(sexp);
+    auto seen = std::vector<std::string>{};
+    for(auto& node : walk) {
+        seen.push_back(node.isString() ? node.value.str : "()");
+        if(node.isString() && node.value.str == "c") {
+            QVERIFY(walk.depth() == 3);
+            QVERIFY(walk.parent()->toString() == "b c");
+            QVERIFY(walk.childIndex() == 1);
+        }
+    }
+    QVERIFY(walk.depth() == 0);
+    auto expected = std::vector<std::string>{"()", "()", "a", "()", "b", "c", "d", "e"};
+    QVERIFY(seen == expected);
+
+    walk = sexpresso::preorder(sexp);
+    seen.clear();
+    for(auto node = walk.next(); node != nullptr; node = walk.next()) {
+        QVERIFY(walk.depth() != 0 || walk.parent() == nullptr);
+        if(walk.depth() == 1) walk.skipChildren();
+        seen.push_back(node->isString() ? node->value.str : "()");
+    }
+    expected = std::vector<std::string>{"()", "()", "e"};
+    QVERIFY(seen == expected);
+}
+
+//----------------------------------------------------------------------------
+// walk_postorder_and_breadth_first() - children before parents, and level by
+// level
+//----------------------------------------------------------------------------
+void SexpressoTests::walk_postorder_and_breadth_first()
+{
+    auto sexp = sexpresso::parse("(a (b c) d) e");
+    auto walk = sexpresso::postorder(sexp);
+    auto seen = std::vector<std::string>{};
+    for(auto& node : walk) {
+        seen.push_back(node.isString() ? node.value.str : "(" + std::to_string(walk.depth()) + ")");
+        if(node.isSexp() && walk.depth() == 2) {
+            QVERIFY(walk.childIndex() == 1);
+            QVERIFY(walk.parent() == &sexp.getChild(0));
+        }
+    }
+    auto expected = std::vector<std::string>{"a", "b", "c", "(2)", "d", "(1)", "e", "(0)"};
+    QVERIFY(seen == expected);
+
+    walk = sexpresso::breadthFirst(sexp);
+    seen.clear();
+    auto depths = std::vector<size_t>{};
+    for(auto& node : walk) {
+        seen.push_back(node.isString() ? node.value.str : "()");
+        depths.push_back(walk.depth());
+        if(node.isSexp() && walk.depth() == 2) walk.skipChildren();
+    }
+    expected = std::vector<std::string>{"()", "()", "e", "a", "()", "d"};
+    QVERIFY(seen == expected);
+    QVERIFY((depths == std::vector<size_t>{0, 1, 1, 2, 2, 2}));
+
+    auto atom = sexpresso::Sexp{"x"};
+    QVERIFY(sexpresso::postorder(atom).next() == &atom);
+    QVERIFY(sexpresso::breadthFirst(atom).next() == &atom);
+}
+
+//----------------------------------------------------------------------------
+// walk_deep_input() - walks do not recurse, however deep the tree
+//----------------------------------------------------------------------------
+void SexpressoTests::walk_deep_input()
+{
+    auto depth = size_t{5000};
+    auto sexp = sexpresso::parse(std::string(depth, '(') + "x" + std::string(depth, ')'));
+    auto maxdepth = size_t{0};
+    auto count = size_t{0};
+    for(auto order : {sexpresso::SexpWalkOrder::PREORDER, sexpresso::SexpWalkOrder::POSTORDER, sexpresso::SexpWalkOrder::BREADTH_FIRST}) {
+        auto walk = sexpresso::SexpWalk{sexp, order};
+        count = 0;
+        for(auto& node : walk) {
+            ++count;
+            if(node.isString()) maxdepth = walk.depth();
+        }
+        QVERIFY(count == depth + 2);
+        QVERIFY(maxdepth == depth + 1);
+    }
+}
+
+static std::string parallelTestTree()
+{
+    std::string str;
+    for(int i = 0; i < 200; ++i) {
+        str += "(item " + std::to_string(i) + " (a b (c d (e " + std::to_string(i) + "))) ";
+        for(int j = 0; j < i % 7; ++j) str += "(x " + std::to_string(j) + ") ";
+        str += ") ";
+    }
+    return str;
+}
+
+//----------------------------------------------------------------------------
+// parallel_visit_counts() - every node is visited exactly once
+//----------------------------------------------------------------------------
+void SexpressoTests::parallel_visit_counts()
+{
+    auto sexp = sexpresso::parse(parallelTestTree());
+    size_t expected = 0;
+    for(auto& node : sexpresso::preorder(sexp)) { (void)node; ++expected; }
+
+    for(size_t threads : {1, 2, 4, 8}) {
+        auto options = sexpresso::SexpParallelOptions{};
+        options.threads = threads;
+        options.grain = 3;
+        auto count = sexpresso::parallelVisit<size_t>(sexp,
+            [](sexpresso::Sexp const&, size_t& n) { ++n; },
+            [](size_t& into, size_t&& from) { into += from; }, options);
+        QVERIFY(count == expected);
+    }
+    auto atom = sexpresso::Sexp{"x"};
+    QVERIFY(sexpresso::parallelVisit<size_t>(atom, [](sexpresso::Sexp const&, size_t& n) { ++n; },
+                                             [](size_t& into, size_t&& from) { into += from; }) == 1);
+}
+
+//----------------------------------------------------------------------------
+// parallel_visit_deterministic() - with deterministic set, results come back
+// in document order whatever the thread count
+//----------------------------------------------------------------------------
+void SexpressoTests::parallel_visit_deterministic()
+{
+    auto sexp = sexpresso::parse(parallelTestTree());
+    auto expected = std::vector<sexpresso::Sexp const*>{};
+    for(auto& node : sexpresso::preorder(sexp)) expected.push_back(&node);
+
+    using Nodes = std::vector<sexpresso::Sexp const*>;
+    for(size_t threads : {1, 3, 8}) {
+        for(size_t grain : {1, 5, 64, 100000}) {
+            auto options = sexpresso::SexpParallelOptions{};
+            options.threads = threads;
+            options.grain = grain;
+            options.deterministic = true;
+            auto nodes = sexpresso::parallelVisit<Nodes>(sexp,
+                [](sexpresso::Sexp const& node, Nodes& out) { out.push_back(&node); },
+                [](Nodes& into, Nodes&& from) { into.insert(into.end(), from.begin(), from.end()); }, options);
+            QVERIFY(nodes == expected);
+        }
+    }
+}
+
+//----------------------------------------------------------------------------
+// parallel_visit_exception() - a throwing visitor stops the visit and the
+// exception reaches the caller
+//----------------------------------------------------------------------------
+void SexpressoTests::parallel_visit_exception()
+{
+    auto sexp = sexpresso::parse(parallelTestTree());
+    auto options = sexpresso::SexpParallelOptions{};
+    options.threads = 4;
+    options.grain = 8;
+    auto caught = false;
+    try {
+        sexpresso::parallelVisit<int>(sexp, [](sexpresso::Sexp const& node, int&) {
+            if(node.isString() && node.value.str == "150") throw std::runtime_error("stop");
+        }, [](int&, int&&) {}, options);
+    } catch(std::runtime_error const& e) {
+        caught = std::string{e.what()} == "stop";
+    }
+    QVERIFY(caught);
+}
+
+//----------------------------------------------------------------------------
+// hash_structural() - equal content hashes alike wherever it is, kinds and
+// attributes change the hash, and edits anywhere in a tree are picked up
+//----------------------------------------------------------------------------
+void SexpressoTests::hash_structural()
+{
+    auto sexp = sexpresso::parse("(a (b \"c\")) (a   (b \"c\")) (a (b c)) '(a (b \"c\")) #(a (b \"c\"))");
+    auto& first = sexp.getChild(0);
+    QVERIFY(first.hash() == sexp.getChild(1).hash());
+    QVERIFY(first.hash() != sexp.getChild(2).hash());
+    QVERIFY(first.hash() != sexp.getChild(3).hash());
+    QVERIFY(first.hash() != sexp.getChild(4).hash());
+
+    auto built = sexpresso::Sexp{};
+    built.addChild(sexpresso::Sexp{"a"});
+    auto inner = sexpresso::Sexp{};
+    inner.addChild(sexpresso::Sexp{"b"});
+    inner.addChild("c");
+    built.addChild(inner);
+    QVERIFY(built.hash() == first.hash());
+
+    auto before = first.hash();
+    first.addChild(sexpresso::Sexp{"d"});
+    QVERIFY(first.hash() != before);
+
+    auto& b = sexp.getChild(1).getChild(1);
+    b.getChild(1).value.str = "changed";
+    QVERIFY(sexp.getChild(1).hash() != before);
+
+    // edits below the top are seen by every ancestor
+    auto cfg = sexpresso::parse("(cfg (port 1))");
+    auto cfghash = cfg.hash();
+    cfg.getChildByPath("cfg/port")->addChild(sexpresso::Sexp{"2"});
+    QVERIFY(cfg.hash() != cfghash);
+    QVERIFY(cfg == sexpresso::parse("(cfg (port 1 2))"));
+    QVERIFY(std::hash<sexpresso::Sexp>{}(cfg) == std::hash<sexpresso::Sexp>{}(sexpresso::parse("(cfg (port 1 2))")));
+
+    // parse() caches every hash, edits made straight to the fields need dropHash()
+    auto direct = sexpresso::parse("(cfg (port 1))");
+    auto& port = direct.value.sexp[0].value.sexp[1];
+    QVERIFY(direct.structhash.value.load() != 0 && port.value.sexp[1].structhash.value.load() != 0);
+    port.value.sexp[1].value.str = "2";
+    direct.dropHash();
+    QVERIFY(direct.hash() == sexpresso::parse("(cfg (port 2))").hash());
+    QVERIFY(direct == sexpresso::parse("(cfg (port 2))"));
+}
+
+//----------------------------------------------------------------------------
+// hash_strict_equal() - strictEqual tells atom kinds, list kinds and
+// attributes apart where equal() does not
+//----------------------------------------------------------------------------
+void SexpressoTests::hash_strict_equal()
+{
+    auto sexp = sexpresso::parse("\"a\" a (x 'y) (x y) (x 'y) #(1 2) (1 2)");
+    QVERIFY(sexp.getChild(0).equal(sexp.getChild(1)));
+    QVERIFY(!sexp.getChild(0).strictEqual(sexp.getChild(1)));
+    QVERIFY(sexp.getChild(2).equal(sexp.getChild(3)));
+    QVERIFY(sexp.getChild(2) != sexp.getChild(3));
+    QVERIFY(sexp.getChild(2) == sexp.getChild(4));
+    QVERIFY(sexp.getChild(5).equal(sexp.getChild(6)));
+    QVERIFY(!sexp.getChild(5).strictEqual(sexp.getChild(6)));
+
+    // positions are not part of the content
+    QVERIFY(sexp.getChild(2).startpos != sexp.getChild(4).startpos);
+}
+
+//----------------------------------------------------------------------------
+// hash_unordered_map_key() - Sexp works as a key through std::hash
+//----------------------------------------------------------------------------
+void SexpressoTests::hash_unordered_map_key()
+{
+    auto sexp = sexpresso::parse("(pad 1) (pad 2) (pad 1) \"pad\" pad (pad 1)");
+    auto counts = std::unordered_map<sexpresso::Sexp, int>{};
+    for(auto& child : sexp.value.sexp) ++counts[child];
+    QVERIFY(counts.size() == 4);
+    QVERIFY(counts[sexp.getChild(0)] == 3);
+    QVERIFY(counts[sexp.getChild(3)] == 1);
+    QVERIFY(counts[sexp.getChild(4)] == 1);
+}
+
+//----------------------------------------------------------------------------
+// shared_interning() - identical subtrees become one node and equality is
+// pointer equality
+//----------------------------------------------------------------------------
+void SexpressoTests::shared_interning()
+{
+    sexpresso::SexpInterner interner;
+    std::string err;
+    auto board = interner.parse("(seg (layer F.Cu) (width 0.25)) (seg (layer F.Cu) (width 0.25)) (seg (layer B.Cu) (width 0.25))", err);
+    QVERIFY(err.empty());
+    QVERIFY(board->childCount() == 3);
+    QVERIFY(board->getChild(0) == board->getChild(1));
+    QVERIFY(board->getChild(0) != board->getChild(2));
+    QVERIFY(board->getChild(0)->getChild(2) == board->getChild(2)->getChild(2));
+    // seg layer F.Cu B.Cu width 0.25, (layer F.Cu) (layer B.Cu) (width 0.25), two segs, the root
+    QVERIFY(interner.size() == 12);
+
+    auto layer = interner.list({interner.atom("layer"), interner.atom("F.Cu")});
+    QVERIFY(layer == board->getChild(0)->getChild(1));
+    QVERIFY(interner.atom("layer", sexpresso::SexpAtomKind::STRING) != interner.atom("layer"));
+    QVERIFY(interner.list({interner.atom("x")}, sexpresso::SexpSexpKind::NONE, {sexpresso::SexpAttributeKind::QUOTE})
+            != interner.list({interner.atom("x")}));
+    QVERIFY(interner.size() == 16);
+}
+
+//----------------------------------------------------------------------------
+// shared_round_trip() - shared nodes convert back to equal Sexp trees
+//----------------------------------------------------------------------------
+void SexpressoTests::shared_round_trip()
+{
+    std::string str = "(defun f (x) '(a b) #(1 2) \"s\" #\\c) (defun f (x) '(a b) #(1 2) \"s\" #\\c)";
+    auto sexp = sexpresso::parse(str);
+    sexpresso::SexpInterner interner;
+    auto shared = interner.intern(sexp);
+    QVERIFY(shared->hash == sexp.hash());
+    auto back = shared->toSexp();
+    QVERIFY(back.strictEqual(sexp));
+    QVERIFY(shared->toString() == sexp.toString());
+    QVERIFY(shared->getChild(1)->toString() == "defun f (x) '(a b) #(1 2) \"s\" #\\c");
+}
+
+//----------------------------------------------------------------------------
+// shared_collect() - nodes nobody holds any more can be dropped
+//----------------------------------------------------------------------------
+void SexpressoTests::shared_collect()
+{
+    sexpresso::SexpInterner interner;
+    std::string err;
+    auto keep = interner.parse("(a b)", err);
+    {
+        auto drop = interner.parse("(c (d e))", err);
+        QVERIFY(interner.size() == 10);
+    }
+    QVERIFY(interner.collect() == 6);
+    QVERIFY(interner.size() == 4);
+    QVERIFY(interner.parse("(a b)", err) == keep);
+}
+
+static bool diffRoundTrips(std::string const& from, std::string const& to)
+{
+    auto a = sexpresso::parse(from);
+    auto b = sexpresso::parse(to);
+    auto patch = sexpresso::diff(a, b);
+    std::string err;
+    return sexpresso::apply(a, patch, err) && err.empty() && a.strictEqual(b) && a.toString() == b.toString();
+}
+
+//----------------------------------------------------------------------------
+// diff_round_trip() - applying diff(a, b) to a gives b
+//----------------------------------------------------------------------------
+void SexpressoTests::diff_round_trip()
+{
+    QVERIFY(diffRoundTrips("(a b c)", "(a b c)"));
+    QVERIFY(diffRoundTrips("(a b c)", "(c a b)"));
+    QVERIFY(diffRoundTrips("(a b c d e f)", "(f e d c b a)"));
+    QVERIFY(diffRoundTrips("(a b c)", "(x a y c z)"));
+    QVERIFY(diffRoundTrips("(a (b 1) (c 2) d)", "(a (c 3) (b 1) e)"));
+    QVERIFY(diffRoundTrips("(module (pad 1 (at 0 0)) (pad 2 (at 1 0)) (layer F.Cu))",
+                           "(module (layer B.Cu) (pad 2 (at 1 0) (size 1 1)) (pad 1 (at 0 0)) (pad 3))"));
+    QVERIFY(diffRoundTrips("(a 'b #(c d))", "(a b (c d))"));
+    QVERIFY(diffRoundTrips("(a b) (c d)", "x"));
+    QVERIFY(diffRoundTrips("", "(a)"));
+    QVERIFY(diffRoundTrips("(a a a b)", "(b a a)"));
+
+    // moves and inserts interleaved over a long list
+    std::string forward = "(", shuffled = "(";
+    for(int i = 0; i < 2000; ++i) forward += " " + std::to_string(i);
+    for(int i = 1999; i >= 0; i -= 2) shuffled += " " + std::to_string(i) + " new" + std::to_string(i);
+    for(int i = 0; i < 2000; i += 2) shuffled += " " + std::to_string(i);
+    QVERIFY(diffRoundTrips(forward + ")", shuffled + ")"));
+}
+
+//----------------------------------------------------------------------------
+// diff_edit_kinds() - unchanged children produce no edits, reordering is a
+// single move, and changed lists are diffed in place
+//----------------------------------------------------------------------------
+void SexpressoTests::diff_edit_kinds()
+{
+    auto a = sexpresso::parse("(x a b c d)");
+    QVERIFY(sexpresso::diff(a, a).empty());
+
+    auto b = sexpresso::parse("(x b c d a)");
+    auto patch = sexpresso::diff(a, b);
+    QVERIFY(patch.edits.size() == 1);
+    QVERIFY(patch.edits[0].kind == sexpresso::SexpEditKind::MOVE);
+    QVERIFY((patch.edits[0].path == std::vector<size_t>{0, 1}));
+    QVERIFY(patch.edits[0].to == 4);
+
+    a = sexpresso::parse("(cfg (width 0.25) (layer F.Cu) (net 1))");
+    b = sexpresso::parse("(cfg (width 0.30) (layer F.Cu) (net 1))");
+    patch = sexpresso::diff(a, b);
+    QVERIFY(patch.edits.size() == 1);
+    QVERIFY(patch.edits[0].kind == sexpresso::SexpEditKind::REPLACE);
+    QVERIFY((patch.edits[0].path == std::vector<size_t>{0, 1, 1}));
+    QVERIFY(patch.edits[0].node.value.str == "0.30");
+
+    b = sexpresso::parse("(cfg (width 0.25) (net 1) (drill 2))");
+    patch = sexpresso::diff(a, b);
+    QVERIFY(patch.edits.size() == 2);
+    QVERIFY(patch.edits[0].kind == sexpresso::SexpEditKind::DELETE);
+    QVERIFY((patch.edits[0].path == std::vector<size_t>{0, 2}));
+    QVERIFY(patch.edits[1].kind == sexpresso::SexpEditKind::INSERT);
+    QVERIFY((patch.edits[1].path == std::vector<size_t>{0, 3}));
+
+    // apply() leaves no stale hashes behind for the next diff
+    auto err = std::string{};
+    QVERIFY(sexpresso::apply(a, patch, err));
+    QVERIFY(sexpresso::diff(a, b).empty());
+    QVERIFY(!sexpresso::diff(a, sexpresso::parse("(cfg (width 0.25) (net 2) (drill 2))")).empty());
+
+    // inserted nodes are written out fresh, not from where they were parsed
+    std::string source = "(cfg (width 0.25) (net 1) ; the net\n)";
+    auto tree = sexpresso::parse(source);
+    QVERIFY(sexpresso::apply(tree, sexpresso::diff(tree, sexpresso::parse("(cfg (width   0.25) (net 1) (drill   2))")), err));
+    QVERIFY(tree.toString(source) == "(cfg (width 0.25) (net 1) (drill 2))");
+}
+
+//----------------------------------------------------------------------------
+// diff_apply_errors() - a patch that does not fit the tree is refused
+//----------------------------------------------------------------------------
+void SexpressoTests::diff_apply_errors()
+{
+    auto a = sexpresso::parse("(a b c)");
+    auto patch = sexpresso::diff(a, sexpresso::parse("(a b c d)"));
+    auto other = sexpresso::parse("x");
+    std::string err;
+    QVERIFY(!sexpresso::apply(other, patch, err));
+    QVERIFY(err == "patch path does not fit the tree");
+
+    err.clear();
+    auto bad = sexpresso::SexpPatch{};
+    bad.edits.push_back(sexpresso::SexpEdit{sexpresso::SexpEditKind::DELETE, {0, 7}, 0, sexpresso::Sexp{}});
+    QVERIFY(!sexpresso::apply(a, bad, err));
+    QVERIFY(err == "patch index out of range");
+}
+
+//----------------------------------------------------------------------------
+// positions_node_at() - innermost node at an offset, prefixes included
+//----------------------------------------------------------------------------
+void SexpressoTests::positions_node_at()
+{
+    //                 0         1         2         3         4
+    //                 012345678901234567890123456789012345678901234567
+    std::string str = "(defun f (x) '(a b) #(1 2) \"s\" #\\c #x1F #'g)\n  (b)";
+    auto sexp = sexpresso::parse(str);
+    auto index = sexpresso::SexpPositionIndex{sexp};
+    auto& defun = sexp.getChild(0);
+    QVERIFY(index.nodeAt(0) == &defun);
+    QVERIFY(index.nodeAt(3) == &defun.getChild(0));
+    QVERIFY(index.nodeAt(6) == &defun); // space after defun
+    QVERIFY(index.nodeAt(10) == &defun.getChild(2).getChild(0));
+    QVERIFY(index.nodeAt(13) == &defun.getChild(3)); // the quote
+    QVERIFY(index.nodeAt(14) == &defun.getChild(3));
+    QVERIFY(index.nodeAt(17) == &defun.getChild(3).getChild(1));
+    QVERIFY(index.nodeAt(20) == &defun.getChild(4)); // #( of a vector
+    QVERIFY(index.nodeAt(27) == &defun.getChild(5)); // opening string quote
+    QVERIFY(index.nodeAt(31) == &defun.getChild(6)); // #\c
+    QVERIFY(index.nodeAt(35) == &defun.getChild(7)); // #x1F
+    QVERIFY(index.nodeAt(41) == &defun.getChild(8)); // #'g
+    QVERIFY(index.nodeAt(45) == &sexp); // between top level forms
+    QVERIFY(index.nodeAt(48) == &sexp.getChild(1).getChild(0));
+    QVERIFY(index.nodeAt(50) == nullptr);
+    QVERIFY(index.nodeAt(-1) == nullptr);
+}
+
+//----------------------------------------------------------------------------
+// positions_range_and_enclosing() - nodes inside a range, and the chain of
+// forms around an offset
+//----------------------------------------------------------------------------
+void SexpressoTests::positions_range_and_enclosing()
+{
+    std::string str = "(defun f (x) '(a b) #(1 2))";
+    auto sexp = sexpresso::parse(str);
+    auto index = sexpresso::SexpPositionIndex{sexp};
+    auto& defun = sexp.getChild(0);
+
+    auto inside = index.nodesInRange(9, 19);
+    QVERIFY(inside.size() == 5);
+    QVERIFY(inside[0] == &defun.getChild(2));
+    QVERIFY(inside[1] == &defun.getChild(2).getChild(0));
+    QVERIFY(inside[2] == &defun.getChild(3));
+    QVERIFY(inside[4] == &defun.getChild(3).getChild(1));
+    QVERIFY(index.nodesInRange(10, 12).size() == 1);
+    QVERIFY(index.nodesInRange(30, 40).empty());
+
+    auto forms = index.enclosingForms(16); // between a and b
+    QVERIFY(forms.size() == 3);
+    QVERIFY(forms[0] == &defun.getChild(3));
+    QVERIFY(forms[1] == &defun);
+    QVERIFY(forms[2] == &sexp);
+    QVERIFY(index.enclosingForms(17).size() == 4);
+    QVERIFY(index.enclosingForms(17)[0] == &defun.getChild(3).getChild(1));
+
+    // nodes made in code have no span and are left out
+    defun.addChild(sexpresso::Sexp{"extra"});
+    auto rebuilt = sexpresso::SexpPositionIndex{sexp};
+    QVERIFY(rebuilt.entries.size() == index.entries.size());
+}
+
+//----------------------------------------------------------------------------
+// shared_path_copying_edits() - edits copy the path to the change, share the
+// rest, and leave the old version as it was
+//----------------------------------------------------------------------------
+void SexpressoTests::shared_path_copying_edits()
+{
+    auto v1 = sexpresso::toShared(sexpresso::parse("(board (layer F.Cu) (net 1) (net 2))"));
+    auto newlayer = sexpresso::toShared(sexpresso::parse("(layer B.Cu)").getChild(0));
+    auto v2 = v1->with(sexpresso::SexpPath{"board/layer"}, newlayer);
+    QVERIFY(v2 != nullptr);
+    QVERIFY(v1->toString() == "(board (layer F.Cu) (net 1) (net 2))");
+    QVERIFY(v2->toString() == "(board (layer B.Cu) (net 1) (net 2))");
+    QVERIFY(v2->getChild(0) != v1->getChild(0));
+    QVERIFY(v2->getChild(0)->getChild(2) == v1->getChild(0)->getChild(2)); // (net 1) is shared
+    QVERIFY(v2->getChildByPath(sexpresso::SexpPath{"board/layer"}) == newlayer);
+    QVERIFY(v2->hash == v2->toSexp().hash());
+
+    auto v3 = v2->withInserted({0, 4}, sexpresso::toShared(sexpresso::Sexp{"end"}));
+    QVERIFY(v3->toString() == "(board (layer B.Cu) (net 1) (net 2) end)");
+    auto v4 = v3->without({0, 2});
+    QVERIFY(v4->toString() == "(board (layer B.Cu) (net 2) end)");
+    QVERIFY(v4->getChild(0)->getChild(1) == newlayer);
+    QVERIFY(v1->with({}, newlayer) == newlayer);
+
+    // interned nodes can be edited too; the results are plain shared nodes
+    sexpresso::SexpInterner interner;
+    std::string err;
+    auto a = interner.parse("(x (y 1) (y 1))", err);
+    auto b = a->with({0, 2, 1}, interner.atom("2"));
+    QVERIFY(b->toString() == "(x (y 1) (y 2))");
+    QVERIFY(a->getChild(0)->getChild(1) == a->getChild(0)->getChild(2));
+    QVERIFY(b->getChild(0)->getChild(1) == a->getChild(0)->getChild(1));
+}
+
+//----------------------------------------------------------------------------
+// shared_edit_errors() - paths that do not fit give nullptr
+//----------------------------------------------------------------------------
+void SexpressoTests::shared_edit_errors()
+{
+    auto v1 = sexpresso::toShared(sexpresso::parse("(a b c)"));
+    auto x = sexpresso::toShared(sexpresso::Sexp{"x"});
+    QVERIFY(v1->with({0, 3}, x) == nullptr);
+    QVERIFY(v1->with({0, 1, 0}, x) == nullptr); // b is an atom
+    QVERIFY(v1->with(sexpresso::SexpPath{"a/nothing"}, x) == nullptr);
+    QVERIFY(v1->withInserted({0, 4}, x) == nullptr);
+    QVERIFY(v1->withInserted({}, x) == nullptr);
+    QVERIFY(v1->without({}) == nullptr);
+    QVERIFY(v1->without({1}) == nullptr);
+    QVERIFY(v1->with(std::vector<size_t>{0}, nullptr) == nullptr);
+}
+
+//----------------------------------------------------------------------------
+// store_publish_and_update() - snapshots survive later versions
+//----------------------------------------------------------------------------
+void SexpressoTests::store_publish_and_update()
+{
+    sexpresso::SexpStore store;
+    QVERIFY(store.load() == nullptr);
+    QVERIFY(store.version() == 0);
+    store.store(sexpresso::toShared(sexpresso::parse("(cfg (port 80))")));
+    auto snapshot = store.load();
+    QVERIFY(store.version() == 1);
+
+    auto published = store.update([](sexpresso::SexpRef const& cur) {
+        return cur->with(std::vector<size_t>{0, 1, 1}, sexpresso::toShared(sexpresso::Sexp{"8080"}));
+    });
+    QVERIFY(published == store.load());
+    QVERIFY(store.version() == 2);
+    QVERIFY(snapshot->toString() == "(cfg (port 80))");
+    QVERIFY(store.load()->toString() == "(cfg (port 8080))");
+
+    QVERIFY(store.update([](sexpresso::SexpRef const&) { return sexpresso::SexpRef{}; }) == nullptr);
+    QVERIFY(store.version() == 2);
+
+    auto seen = std::string{};
+    store.read([&seen](sexpresso::SexpNode const* root) { seen = root->toString(); });
+    QVERIFY(seen == "(cfg (port 8080))");
+    sexpresso::SexpStore empty;
+    auto none = false;
+    empty.read([&none](sexpresso::SexpNode const* root) { none = root == nullptr; });
+    QVERIFY(none);
+}
+
+//----------------------------------------------------------------------------
+// store_concurrent_readers() - readers always see a whole version while
+// writers publish new ones
+//----------------------------------------------------------------------------
+void SexpressoTests::store_concurrent_readers()
+{
+    sexpresso::SexpStore store{sexpresso::toShared(sexpresso::parse("(cfg (a 0) (b 0))"))};
+    std::atomic<bool> done{false};
+    std::atomic<int> torn{0};
+    auto readers = std::vector<std::thread>{};
+    for(int r = 0; r < 4; ++r) {
+        readers.emplace_back([&store, &done, &torn, r]() {
+            while(!done) {
+                auto check = [&torn](sexpresso::SexpNode const* root) {
+                    auto a = root->getChild(0)->getChild(1)->getChild(1)->str;
+                    auto b = root->getChild(0)->getChild(2)->getChild(1)->str;
+                    if(a != b) ++torn;
+                };
+                if(r % 2 == 0) check(store.load().get());
+                else store.read(check);
+            }
+        });
+    }
+    auto writers = std::vector<std::thread>{};
+    for(int w = 0; w < 2; ++w) {
+        writers.emplace_back([&store]() {
+            for(int i = 0; i < 200; ++i) {
+                store.update([](sexpresso::SexpRef const& cur) {
+                    auto next = std::to_string(std::stoi(cur->getChild(0)->getChild(1)->getChild(1)->str) + 1);
+                    auto value = sexpresso::toShared(sexpresso::Sexp{next});
+                    return cur->with(std::vector<size_t>{0, 1, 1}, value)->with(std::vector<size_t>{0, 2, 1}, value);
+                });
+            }
+        });
+    }
+    for(auto& writer : writers) writer.join();
+    done = true;
+    for(auto& reader : readers) reader.join();
+    QVERIFY(torn == 0);
+    QVERIFY(store.load()->getChild(0)->getChild(1)->getChild(1)->str == "400");
+    QVERIFY(store.version() == 401);
+}
+
+//----------------------------------------------------------------------------
+// files_parse_async() - every file gets a result in path order, errors
+// included, and the callback sees each one
+//----------------------------------------------------------------------------
+void SexpressoTests::files_parse_async()
+{
+    auto paths = std::vector<std::string>{};
+    for(int i = 0; i < 20; ++i) {
+        paths.push_back("sexpresso_files_test_" + std::to_string(i) + ".sexp");
+        std::ofstream out(paths.back(), std::ios::binary);
+        out << "(file " << i << ")";
+        for(int j = 0; j < i * 50; ++j) out << " (item " << j << ")";
+        if(i == 7) out << " (unclosed";
+    }
+    paths.push_back("sexpresso_files_test_missing.sexp");
+
+    auto options = sexpresso::SexpFileOptions{};
+    options.threads = 3;
+    options.queued = 2;
+    options.keepSource = true;
+    std::atomic<int> called{0};
+    options.onFile = [&called](sexpresso::SexpFileResult const&) { ++called; };
+    {
+        auto batch = sexpresso::parseFilesAsync(paths, options);
+        QVERIFY(batch.results.size() == paths.size());
+        for(size_t i = 0; i < batch.results.size(); ++i) {
+            auto file = batch.results[i].get();
+            QVERIFY(file.path == paths[i]);
+            if(i == 20) {
+                QVERIFY(file.err == "could not read sexpresso_files_test_missing.sexp");
+                continue;
+            }
+            if(i == 7) {
+                QVERIFY(file.err == "not enough s-expressions were closed by the end of parsing");
+                continue;
+            }
+            QVERIFY(file.err.empty());
+            QVERIFY(file.sexp.getChild(0).getChild(1).value.str == std::to_string(i));
+            QVERIFY(file.sexp.childCount() == 1 + i * 50);
+            QVERIFY(file.sexp.toString(file.source) == file.source);
+        }
+    }
+    QVERIFY(called == 21);
+    for(auto& path : paths) std::remove(path.c_str());
+}
+
+//----------------------------------------------------------------------------
+// diskcache_warm_restart() - a second cache on the same directory loads the
+// tree from the entry written by the first
+//----------------------------------------------------------------------------
+void SexpressoTests::diskcache_warm_restart()
+{
+    auto path = std::string{"sexpresso_diskcache_test.sexp"};
+    auto source = std::string{"(module 'foo (pad 1 \"a\") #(1 2)) (at 10 20)"};
+    {
+        std::ofstream out(path, std::ios::binary);
+        out << source;
+    }
+    auto parsed = sexpresso::parse(source);
+    auto err = std::string{};
+    {
+        sexpresso::SexpDiskCache cache{"."};
+        auto sexp = cache.parseFile(path, err);
+        QVERIFY(err.empty());
+        QVERIFY(sexp == parsed);
+        QVERIFY(cache.misses == 1 && cache.writes == 1 && cache.hits == 0);
+    }
+    sexpresso::SexpDiskCache cache{"."};
+    auto sexp = cache.parseFile(path, err);
+    QVERIFY(err.empty());
+    QVERIFY(cache.hits == 1 && cache.misses == 0);
+    QVERIFY(sexp == parsed);
+    QVERIFY(sexp.toString(source) == source);
+    QVERIFY(sexp.getChild(1).startpos == parsed.getChild(1).startpos);
+
+    cache.parseFile("sexpresso_diskcache_missing.sexp", err);
+    QVERIFY(err == "could not read sexpresso_diskcache_missing.sexp");
+    cache.invalidate(path);
+    std::remove(path.c_str());
+}
+
+//----------------------------------------------------------------------------
+// diskcache_stale_entries() - changed files are parsed again, failed parses
+// are not cached and prune() drops entries of deleted files
+//----------------------------------------------------------------------------
+void SexpressoTests::diskcache_stale_entries()
+{
+    auto path = std::string{"sexpresso_diskcache_stale.sexp"};
+    auto write = [&path](char const* text) {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out << text;
+    };
+    auto err = std::string{};
+    sexpresso::SexpDiskCache cache{".", sexpresso::SexpCacheValidation::CONTENT};
+    write("(a 1)");
+    QVERIFY(cache.parseFile(path, err).toString() == "(a 1)");
+    write("(b 2)"); // same size, caught by the content hash
+    QVERIFY(cache.parseFile(path, err).toString() == "(b 2)");
+    QVERIFY(cache.parseFile(path, err).toString() == "(b 2)");
+    QVERIFY(cache.misses == 2 && cache.hits == 1);
+
+    write("(unclosed");
+    cache.parseFile(path, err);
+    QVERIFY(err == "not enough s-expressions were closed by the end of parsing");
+    err.clear();
+    cache.parseFile(path, err);
+    QVERIFY(!err.empty());
+    QVERIFY(cache.writes == 2);
+    err.clear();
+
+    write("(c 3 4)");
+    QVERIFY(cache.parseFile(path, err).toString() == "(c 3 4)");
+    std::ifstream entry(cache.entryPath(path), std::ios::binary);
+    QVERIFY(static_cast<bool>(entry));
+    entry.close();
+
+    // prune() only needs the header: a fresh entry stays, a cut off one goes
+    auto broken = cache.entryPath("sexpresso_diskcache_broken.sexp");
+    std::ofstream(broken, std::ios::binary) << "SXPC\x01";
+    QVERIFY(cache.prune() >= 1);
+    QVERIFY(static_cast<bool>(std::ifstream(cache.entryPath(path))));
+    QVERIFY(!std::ifstream(broken));
+
+    std::remove(path.c_str());
+    QVERIFY(cache.prune() >= 1);
+    QVERIFY(!std::ifstream(cache.entryPath(path)));
+}
+
+//----------------------------------------------------------------------------
+// parsecache_hits_and_evictions() - repeated inputs share one tree, the least
+// recently used entry goes first once the size limit is reached
+//----------------------------------------------------------------------------
+void SexpressoTests::parsecache_hits_and_evictions()
+{
+    auto err = std::string{};
+    sexpresso::SexpParseCache probe{1 << 20, 1};
+    probe.parse("(ping 1)", err);
+    auto entry = probe.stats().bytes;
+    QVERIFY(entry > std::string{"(ping 1)"}.size());
+
+    sexpresso::SexpParseCache cache{2 * entry, 1}; // room for two pings
+    auto a = cache.parse("(ping 1)", err);
+    QVERIFY(err.empty() && a != nullptr);
+    QVERIFY(cache.parse("(ping 1)", err) == a);
+    auto b = cache.parse("(ping 2)", err);
+    QVERIFY(b != a && b->getChild(0).getChild(1).value.str == "2");
+    cache.parse("(ping 1)", err); // (ping 2) is now least recently used
+    cache.parse("(ping 3)", err);
+    auto stats = cache.stats();
+    QVERIFY(stats.hits == 2 && stats.misses == 3 && stats.evictions == 1 && stats.entries == 2);
+    QVERIFY(stats.bytes == 2 * entry);
+    QVERIFY(cache.parse("(ping 1)", err) == a);
+    QVERIFY(cache.parse("(ping 2)", err) != b);
+    QVERIFY(b->toString() == "(ping 2)");
+
+    // too large for the cache on its own: parsed, but nothing is evicted for it
+    auto large = "(blob \"" + std::string(4 * entry, 'x') + "\")";
+    QVERIFY(cache.parse(large, err)->getChild(0).getChild(1).value.str.size() == 4 * entry);
+    QVERIFY(cache.parse(large, err) != cache.parse(large, err));
+    QVERIFY(cache.stats().entries == 2 && cache.stats().bytes == 2 * entry);
+
+    QVERIFY(cache.parse("(ping", err) == nullptr);
+    QVERIFY(err == "not enough s-expressions were closed by the end of parsing");
+    cache.clear();
+    QVERIFY(cache.stats().entries == 0);
+}
+
+//----------------------------------------------------------------------------
+// parsecache_concurrent() - threads looking up the same inputs all get equal
+// trees and every lookup is counted
+//----------------------------------------------------------------------------
+void SexpressoTests::parsecache_concurrent()
+{
+    sexpresso::SexpParseCache cache{64 << 10};
+    std::atomic<int> wrong{0};
+    auto threads = std::vector<std::thread>{};
+    for(int t = 0; t < 4; ++t) {
+        threads.emplace_back([&cache, &wrong, t]() {
+            auto err = std::string{};
+            for(int i = 0; i < 2000; ++i) {
+                auto n = (i * 7 + t) % 100;
+                auto sexp = cache.parse("(msg " + std::to_string(n) + ")", err);
+                if(sexp == nullptr || sexp->getChild(0).getChild(1).value.str != std::to_string(n)) ++wrong;
+            }
+        });
+    }
+    for(auto& thread : threads) thread.join();
+    QVERIFY(wrong == 0);
+    auto stats = cache.stats();
+    QVERIFY(stats.hits + stats.misses == 8000);
+    QVERIFY(stats.bytes <= (64 << 10) && stats.hits > 0);
+}
+
+//----------------------------------------------------------------------------
+// feature_expressions() - #+ and #- keep or drop the next form, dropped forms
+// may hold anything that merely looks like brackets
+//----------------------------------------------------------------------------
+void SexpressoTests::feature_expressions()
+{
+    auto options = sexpresso::SexpParseOptions{};
+    options.featureExpressions = true;
+    options.features = {"sbcl", "unix"};
+    auto err = std::string{};
+
+    auto sexp = sexpresso::parse("(a #+sbcl b #-sbcl c #+:SBCL d)", err, options);
+    QVERIFY(err.empty());
+    QVERIFY(sexp.toString() == "(a b d)");
+    QVERIFY(sexp.getChild(0).getChild(2).startpos == 29);
+
+    sexp = sexpresso::parse("(#+(and sbcl (not win32)) yes #+(or ccl win32) (no \"x)\" #\\) ; )\n #| ) |#) z)", err, options);
+    QVERIFY(err.empty());
+    QVERIFY(sexp.toString() == "(yes z)");
+
+    sexp = sexpresso::parse("#+ccl #+sbcl a b #-unix '#(1 2) #-unix #c(1 2) #+ccl #\\( c", err, options);
+    QVERIFY(err.empty());
+    QVERIFY(sexp.toString() == "b c");
+
+    // a nested conditional that drops its form makes the outer one take the next
+    sexp = sexpresso::parse("#+nil #+nil a b c", err, options);
+    QVERIFY(err.empty());
+    QVERIFY(sexp.toString() == "c");
+    sexp = sexpresso::parse("(#+(or) #+(or) x y z) (#-sbcl #-unix a b c)", err, options);
+    QVERIFY(err.empty());
+    QVERIFY(sexp.toString() == "(z) (c)");
+    sexp = sexpresso::parse("(#+nil #+nil a)", err, options);
+    QVERIFY(err == "Missing form after feature expression");
+    err.clear();
+    sexpresso::parse("(#+nil #+(xor) a b)", err, options);
+    QVERIFY(err == "Unknown feature expression operator :xor");
+    err.clear();
+
+    sexp = sexpresso::parse("(#+sbcl a)", err);
+    QVERIFY(sexp.getChild(0).getChild(0).value.str == "#+sbcl");
+}
+
+//----------------------------------------------------------------------------
+// feature_expression_errors() - malformed feature expressions are reported
+//----------------------------------------------------------------------------
+void SexpressoTests::feature_expression_errors()
+{
+    auto options = sexpresso::SexpParseOptions{};
+    options.featureExpressions = true;
+    auto err = std::string{};
+
+    sexpresso::parse("(#+(xor a) b)", err, options);
+    QVERIFY(err == "Unknown feature expression operator :xor");
+    err.clear();
+    sexpresso::parse("#+(not a b) c", err, options);
+    QVERIFY(err == "(:not) takes exactly one feature expression");
+    err.clear();
+    sexpresso::parse("#+(or a", err, options);
+    QVERIFY(err == "Unterminated feature expression");
+    err.clear();
+    auto sexp = sexpresso::parse("(x #+ccl)", err, options);
+    QVERIFY(err == "Missing form after feature expression");
+    QVERIFY(sexp.getChild(0).getChild(1).value.str == ":sexpresso-error");
+}
+
+//----------------------------------------------------------------------------
+// symbols_classified() - keywords, package references and escaped symbols
+// get their kind and interned package and name
+//----------------------------------------------------------------------------
+void SexpressoTests::symbols_classified()
+{
+    auto table = sexpresso::SexpSymbolTable{};
+    auto options = sexpresso::SexpParseOptions{};
+    options.symbols = &table;
+    auto err = std::string{};
+    auto sexp = sexpresso::parse("(cl-user::foo alexandria:when-let :key |Foo Bar| #:g foo 12 -3 #b101 \"str\")", err, options);
+    QVERIFY(err.empty());
+    auto& list = sexp.getChild(0);
+    QVERIFY(list.childCount() == 10);
+
+    QVERIFY(list.getChild(0).symbolKind() == sexpresso::SexpSymbolKind::INTERNAL);
+    QVERIFY(table.name(list.getChild(0).packageId()) == "cl-user");
+    QVERIFY(table.name(list.getChild(0).nameId()) == "foo");
+    QVERIFY(list.getChild(1).symbolKind() == sexpresso::SexpSymbolKind::EXTERNAL);
+    QVERIFY(table.name(list.getChild(1).packageId()) == "alexandria");
+    QVERIFY(table.name(list.getChild(1).nameId()) == "when-let");
+    QVERIFY(list.getChild(2).symbolKind() == sexpresso::SexpSymbolKind::KEYWORD);
+    QVERIFY(list.getChild(2).packageId() == 0);
+    QVERIFY(table.name(list.getChild(2).nameId()) == "key");
+    QVERIFY(list.getChild(3).symbolKind() == sexpresso::SexpSymbolKind::PLAIN);
+    QVERIFY(table.name(list.getChild(3).nameId()) == "Foo Bar");
+    QVERIFY(list.getChild(4).symbolKind() == sexpresso::SexpSymbolKind::UNINTERNED);
+    QVERIFY(list.getChild(5).nameId() == list.getChild(0).nameId());
+    QVERIFY(table.find("foo") == list.getChild(0).nameId());
+    for(size_t i = 6; i < 10; ++i) QVERIFY(list.getChild(i).symbolKind() == sexpresso::SexpSymbolKind::NONE);
+    QVERIFY(sexp.toString() == "(cl-user::foo alexandria:when-let :key |Foo Bar| #:g foo 12 -3 #b101 \"str\")");
+
+    sexp = sexpresso::parse("(cl-user::foo)", err);
+    QVERIFY(sexp.getChild(0).getChild(0).symbolKind() == sexpresso::SexpSymbolKind::NONE);
+    QVERIFY(!sexp.getChild(0).getChild(0).extra.ptr); // nothing allocated without a table
+}
+
+//----------------------------------------------------------------------------
+// symbols_case_folding() - readcase folds unescaped letters of interned names
+//----------------------------------------------------------------------------
+void SexpressoTests::symbols_case_folding()
+{
+    auto table = sexpresso::SexpSymbolTable{};
+    auto options = sexpresso::SexpParseOptions{};
+    options.symbols = &table;
+    options.readcase = sexpresso::SexpReadCase::UPCASE;
+    auto err = std::string{};
+    auto sexp = sexpresso::parse("Cl:Car pkg::|a b|c x\\y", err, options);
+    QVERIFY(err.empty());
+    QVERIFY(table.name(sexp.getChild(0).packageId()) == "CL");
+    QVERIFY(table.name(sexp.getChild(0).nameId()) == "CAR");
+    QVERIFY(table.name(sexp.getChild(1).nameId()) == "a bC");
+    QVERIFY(table.name(sexp.getChild(2).nameId()) == "Xy");
+    QVERIFY(sexp.getChild(0).value.str == "Cl:Car");
+
+    options.readcase = sexpresso::SexpReadCase::INVERT;
+    sexp = sexpresso::parse("abc ABC Abc", err, options);
+    QVERIFY(table.name(sexp.getChild(0).nameId()) == "ABC");
+    QVERIFY(table.name(sexp.getChild(1).nameId()) == "abc");
+    QVERIFY(table.name(sexp.getChild(2).nameId()) == "Abc");
+}
+
+//----------------------------------------------------------------------------
+// labels_read_shared() - #n# gives the very node #n= labeled, bad labels are
+// errors
+//----------------------------------------------------------------------------
+void SexpressoTests::labels_read_shared()
+{
+    auto err = std::string{};
+    auto dump = sexpresso::parseLabeled("(#1=(x #2=(y)) #2# #1# '#3=\"s\" #3#)", err);
+    QVERIFY(err.empty() && dump != nullptr);
+    auto& list = dump->getChild(0);
+    QVERIFY(list->getChild(2) == list->getChild(0));
+    QVERIFY(list->getChild(1) == list->getChild(0)->getChild(1));
+    QVERIFY(list->getChild(3)->toString() == "'\"s\"");
+    QVERIFY(list->getChild(4)->toString() == "\"s\"");
+    QVERIFY(dump->toString() == "((x (y)) (y) (x (y)) '\"s\" \"s\")");
+    QVERIFY(list->hash == sexpresso::parse("((x (y)) (y) (x (y)) '\"s\" \"s\")").getChild(0).hash());
+
+    QVERIFY(sexpresso::parseLabeled("#1=(a #1#)", err) == nullptr);
+    QVERIFY(err == "label #1# is used inside its own form, cycles are not supported");
+    err.clear();
+    QVERIFY(sexpresso::parseLabeled("(#5#)", err) == nullptr);
+    QVERIFY(err == "label #5# is not defined");
+    err.clear();
+    QVERIFY(sexpresso::parseLabeled("(#1=(a) #1=(b))", err) == nullptr);
+    QVERIFY(err == "label #1= is defined twice");
+}
+
+//----------------------------------------------------------------------------
+// labels_write_shared() - shared nodes print once with a label, however they
+// were shared
+//----------------------------------------------------------------------------
+void SexpressoTests::labels_write_shared()
+{
+    auto err = std::string{};
+    auto text = std::string{"(#1=(big #2=(form)) #1# #2# #(#2#))"};
+    auto dump = sexpresso::parseLabeled(text, err);
+    QVERIFY(sexpresso::toLabeledString(dump) == text);
+    QVERIFY(sexpresso::toLabeledString(dump, sexpresso::SexpressoPrintMode::TOP_LEVEL_PARENS) == "(" + text + ")");
+
+    sexpresso::SexpInterner interner;
+    auto interned = interner.parse("(a (b c) '(b c) (b c) \"str\" \"str\" x x)", err);
+    QVERIFY(sexpresso::toLabeledString(interned) == "(a #1=(b c) '(b c) #1# #2=\"str\" #2# x x)");
+    QVERIFY(sexpresso::parseLabeled(sexpresso::toLabeledString(interned), err)->hash == interned->hash);
+}
+
+//----------------------------------------------------------------------------
+// dotted_pairs() - (a . b) reads as a dotted list with the tail as its last
+// child, and prints back the same way
+//----------------------------------------------------------------------------
+void SexpressoTests::dotted_pairs()
+{
+    auto str = std::string{"((width . 10) (name . \"pad\") (a b . c) (x .y) (. z) #(1 . 2))"};
+    auto sexp = sexpresso::parse(str);
+    auto& alist = sexp.getChild(0);
+    auto& width = alist.getChild(0);
+    QVERIFY(width.dotted);
+    QVERIFY(width.childCount() == 2);
+    QVERIFY(width.getTail() != nullptr && width.getTail()->value.str == "10");
+    QVERIFY(alist.getChild(1).getTail()->atomkind == sexpresso::SexpAtomKind::STRING);
+    QVERIFY(alist.getChild(2).childCount() == 3 && alist.getChild(2).getTail()->value.str == "c");
+    QVERIFY(!alist.getChild(3).dotted && alist.getChild(3).childCount() == 2);
+    QVERIFY(!alist.getChild(4).dotted && alist.getChild(4).childCount() == 2);
+    QVERIFY(!alist.getChild(5).dotted && alist.getChild(5).childCount() == 3);
+    QVERIFY(alist.getTail() == nullptr);
+    QVERIFY(sexp.toString() == str);
+    QVERIFY(sexp.toString(str) == str);
+
+    auto proper = sexpresso::parse("(width 10)").getChild(0);
+    QVERIFY(!width.equal(proper));
+    QVERIFY(width != proper);
+    QVERIFY(width.hash() != proper.hash());
+    QVERIFY(width == sexpresso::parse("(width . 10)").getChild(0));
+
+    // added children go before the tail, which stays the tail
+    auto pair = sexpresso::parse("(a . b)").getChild(0);
+    pair.enableIndex();
+    QVERIFY(pair.getChildByPath("b") != nullptr);
+    pair.addChild(sexpresso::Sexp{"c"});
+    pair.createPath("d");
+    QVERIFY(pair.dotted && pair.childCount() == 4);
+    QVERIFY(pair.toString() == "a c (d) . b");
+    QVERIFY(pair.getTail()->value.str == "b");
+    QVERIFY(pair.getChildByPath("c") == &pair.getChild(1));
+    QVERIFY(pair.getChildByPath("b") == pair.getTail());
+
+    // . ?var takes the rest of a list, and with a dotted list the tail too
+    auto match = sexpresso::SexpMatch{};
+    auto defun = sexpresso::parse("(defun f (x) x)").getChild(0);
+    QVERIFY(sexpresso::matchPattern("(defun ?name . ?rest)", defun, match));
+    QVERIFY(match.get("rest")->count == 2 && !match.get("rest")->dotted);
+    QVERIFY(sexpresso::matchPattern("(defun . (?name . ?rest))", defun, match));
+    QVERIFY(match.get("name")->first->value.str == "f" && match.get("rest")->count == 2);
+    QVERIFY(sexpresso::matchPattern("(?k . ?v)", proper, match));
+    QVERIFY(match.get("v")->count == 1 && !match.get("v")->dotted);
+    QVERIFY(sexpresso::matchPattern("(?k . ?v)", width, match));
+    QVERIFY(match.get("k")->first->value.str == "width");
+    QVERIFY(match.get("v")->count == 1 && match.get("v")->dotted && match.get("v")->first == width.getTail());
+    QVERIFY(sexpresso::matchPattern("(a . ?r)", alist.getChild(2), match));
+    QVERIFY(match.get("r")->count == 2 && match.get("r")->dotted && match.get("r")->first[1].value.str == "c");
+    QVERIFY(sexpresso::matchPattern("(width ...)", width, match));
+
+    // without the dot a pattern is a proper list, and other tails only match a dotted tail
+    QVERIFY(!sexpresso::matchPattern("(?k ?v)", width, match));
+    QVERIFY(sexpresso::matchPattern("(?k . 10)", width, match));
+    QVERIFY(!sexpresso::matchPattern("(?k . 10)", proper, match));
+    QVERIFY(sexpresso::matchPattern("(?a ?b . c)", alist.getChild(2), match));
+    QVERIFY(!sexpresso::matchPattern("(?a ?b . c)", sexpresso::parse("(a b c)").getChild(0), match));
+    auto err = std::string{};
+    sexpresso::SexpPatternSet set;
+    QVERIFY(set.add("(?k . ?v:symbol)", err) == SIZE_MAX);
+    QVERIFY(err == "a rest variable cannot have a guard");
+}
+
+//----------------------------------------------------------------------------
+// dotted_pairs_formats() - binary, image and shared trees keep the tail
+//----------------------------------------------------------------------------
+void SexpressoTests::dotted_pairs_formats()
+{
+    auto sexp = sexpresso::parse("((a . 1) (b c . d) (e f))");
+    auto err = std::string{};
+    auto binary = sexpresso::parseBinary(sexpresso::toBinary(sexp), err);
+    QVERIFY(err.empty());
+    QVERIFY(binary == sexp);
+    QVERIFY(binary.getChild(0).getChild(1).dotted);
+
+    sexpresso::SexpImage image;
+    QVERIFY(image.load(sexpresso::toImage(sexp), err));
+    QVERIFY(image.root().getChild(0).getChild(0).dotted());
+    QVERIFY(image.root().getChild(0).getChild(0).sexpkind() == sexpresso::SexpSexpKind::NONE);
+    QVERIFY(!image.root().getChild(0).getChild(2).dotted());
+    QVERIFY(image.root().toSexp() == sexp);
+
+    auto shared = sexpresso::toShared(sexp);
+    QVERIFY(shared->getChild(0)->getChild(1)->dotted);
+    QVERIFY(shared->hash == sexp.hash());
+    QVERIFY(shared->toString() == "((a . 1) (b c . d) (e f))");
+    sexpresso::SexpInterner interner;
+    QVERIFY(interner.intern(sexp)->toSexp() == sexp);
+    auto labeled = sexpresso::parseLabeled("(#1=(k . v) #1#)", err);
+    QVERIFY(sexpresso::toLabeledString(labeled) == "(#1=(k . v) #1#)");
+}
+
+//----------------------------------------------------------------------------
+// readtable_macro_characters() - registered characters read their own
+// syntax, keep positions and end symbols
+//----------------------------------------------------------------------------
+void SexpressoTests::readtable_macro_characters()
+{
+    auto readtable = sexpresso::SexpReadtable{};
+    auto options = sexpresso::SexpParseOptions{};
+    options.readtable = &readtable;
+    readtable.setMacroCharacter('[', [&options](std::string const& str, size_t& pos, sexpresso::Sexp& result, std::string& err) {
+        ++pos;
+        result = sexpresso::readDelimited(str, pos, ']', err, options);
+        result.sexpkind = sexpresso::SexpSexpKind::VECTOR;
+        return err.empty() ? sexpresso::SexpMacroResult::FORM : sexpresso::SexpMacroResult::ERROR;
+    });
+    readtable.setMacroCharacter('!', [](std::string const& str, size_t& pos, sexpresso::Sexp&, std::string&) {
+        while(pos < str.size() && str[pos] != '\n') ++pos;
+        return sexpresso::SexpMacroResult::NONE;
+    });
+
+    auto err = std::string{};
+    auto str = std::string{"(f [a (b c) [d]] foo[1] ! ignored\n z)"};
+    auto sexp = sexpresso::parse(str, err, options);
+    QVERIFY(err.empty());
+    QVERIFY(sexp.toString() == "(f #(a (b c) #(d)) foo #(1) z)");
+    auto& vec = sexp.getChild(0).getChild(1);
+    QVERIFY(vec.startpos == 3 && vec.endpos == 16);
+    QVERIFY(vec.getChild(1).startpos == 6 && vec.getChild(1).endpos == 11);
+    QVERIFY(sexp.getChild(0).getChild(2).value.str == "foo");
+    QVERIFY(sexp.getChild(0).getChild(4).startpos == 35);
+
+    sexpresso::parse("(a [b)", err, options);
+    QVERIFY(err == "Unterminated read macro, expected ']'");
+    err.clear();
+    QVERIFY(sexpresso::parse("(a [b])", err).toString() == "(a [b])");
+
+    // a macro that edits what readDelimited gave it compares equal to the
+    // form it rewrites to
+    readtable.setMacroCharacter('[', [&options](std::string const& str, size_t& pos, sexpresso::Sexp& result, std::string& err) {
+        ++pos;
+        result = sexpresso::readDelimited(str, pos, ']', err, options);
+        result.value.sexp.insert(result.value.sexp.begin(), sexpresso::Sexp{"vector"});
+        result.dirty = true;
+        return err.empty() ? sexpresso::SexpMacroResult::FORM : sexpresso::SexpMacroResult::ERROR;
+    });
+    auto rewritten = sexpresso::parse("(x [a (b)] '[c])", err, options);
+    auto expected = sexpresso::parse("(x (vector a (b)) '(vector c))", err);
+    QVERIFY(err.empty());
+    QVERIFY(rewritten == expected);
+    QVERIFY(rewritten.hash() == expected.hash());
+}
+
+//----------------------------------------------------------------------------
+// readtable_dispatch() - # sub-characters can add syntax or replace the
+// built in meaning
+//----------------------------------------------------------------------------
+void SexpressoTests::readtable_dispatch()
+{
+    auto readtable = sexpresso::SexpReadtable{};
+    auto options = sexpresso::SexpParseOptions{};
+    options.readtable = &readtable;
+    readtable.setDispatchMacroCharacter('r', [](std::string const& str, size_t& pos, sexpresso::Sexp& result, std::string& err) {
+        pos += 2;
+        auto close = pos < str.size() && str[pos] == '"' ? str.find('"', pos + 1) : std::string::npos;
+        if(close == std::string::npos) {
+            err = "#r needs a \"string\"";
+            return sexpresso::SexpMacroResult::ERROR;
+        }
+        result = sexpresso::Sexp::unescaped(str.substr(pos + 1, close - pos - 1), sexpresso::SexpAtomKind::STRING, 0, 0);
+        pos = close + 1;
+        return sexpresso::SexpMacroResult::FORM;
+    });
+    readtable.setDispatchMacroCharacter('x', [](std::string const&, size_t& pos, sexpresso::Sexp& result, std::string&) {
+        pos += 2;
+        result = sexpresso::Sexp{"hex-disabled"};
+        return sexpresso::SexpMacroResult::FORM;
+    });
+
+    auto err = std::string{};
+    auto sexp = sexpresso::parse("(match '#r\"[a-z]+\" #xff #b101)", err, options);
+    QVERIFY(err.empty());
+    auto& list = sexp.getChild(0);
+    QVERIFY(list.getChild(1).atomkind == sexpresso::SexpAtomKind::STRING);
+    QVERIFY(list.getChild(1).value.str == "[a-z]+");
+    QVERIFY(list.getChild(1).attributes.size() == 1);
+    QVERIFY(list.getChild(1).startpos == 7 && list.getChild(1).endpos == 18);
+    QVERIFY(list.getChild(2).value.str == "hex-disabled");
+    QVERIFY(list.getChild(4).atomkind == sexpresso::SexpAtomKind::BINARY);
+
+    sexpresso::parse("#r x", err, options);
+    QVERIFY(err == "#r needs a \"string\"");
+}
+
 QTEST_APPLESS_MAIN(SexpressoTests)
 
 #include "tst_sexpressotests.moc"
@@ -6,10 +6,37 @@ CONFIG += staticlib
 
 HEADERS += \
     sexpresso/sexpresso.hpp \
+    sexpresso/sexpresso_binary.hpp \
+    sexpresso/sexpresso_image.hpp \
+    sexpresso/sexpresso_query.hpp \
+    sexpresso/sexpresso_pattern.hpp \
+    sexpresso/sexpresso_walk.hpp \
+    sexpresso/sexpresso_parallel.hpp \
+    sexpresso/sexpresso_shared.hpp \
+    sexpresso/sexpresso_diff.hpp \
+    sexpresso/sexpresso_positions.hpp \
+    sexpresso/sexpresso_store.hpp \
+    sexpresso/sexpresso_files.hpp \
+    sexpresso/sexpresso_diskcache.hpp \
+    sexpresso/sexpresso_parsecache.hpp \
+    sexpresso/sexpresso_internal.hpp \
 
 
 SOURCES += \
     sexpresso/sexpresso.cpp \
+    sexpresso/sexpresso_binary.cpp \
+    sexpresso/sexpresso_image.cpp \
+    sexpresso/sexpresso_query.cpp \
+    sexpresso/sexpresso_pattern.cpp \
+    sexpresso/sexpresso_walk.cpp \
+    sexpresso/sexpresso_parallel.cpp \
+    sexpresso/sexpresso_shared.cpp \
+    sexpresso/sexpresso_diff.cpp \
+    sexpresso/sexpresso_positions.cpp \
+    sexpresso/sexpresso_store.cpp \
+    sexpresso/sexpresso_files.cpp \
+    sexpresso/sexpresso_diskcache.cpp \
+    sexpresso/sexpresso_parsecache.cpp \
 
 SUBDIRS += \
     sexpresso-project.pro
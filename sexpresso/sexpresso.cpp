@@ -4,12 +4,14 @@
 #include <string>
 #include <cstdint>
 #include "sexpresso.hpp"
+#include "sexpresso_internal.hpp"
 #include <stack>
 #include <cctype>
 #include <algorithm>
 #include <sstream>
 #include <array>
 #include <iostream>
+#include <cstring>
 
 namespace sexpresso {
 
@@ -76,12 +78,90 @@ namespace sexpresso {
         this->value.endpos = 0;
     }
 
+    static auto indexKey(Sexp const& child, uint64_t& key) -> bool {
+        switch(child.kind) {
+            case SexpValueKind::ATOM:
+                key = hashString(child.value.str.data(), child.value.str.size());
+                return true;
+            case SexpValueKind::SEXP:
+                if(child.value.sexp.empty() || child.value.sexp[0].kind != SexpValueKind::ATOM) return false;
+                key = hashString(child.value.sexp[0].value.str.data(), child.value.sexp[0].value.str.size());
+                return true;
+        }
+        return false;
+    }
+
+    SexpExtraPtr::SexpExtraPtr(SexpExtraPtr const& other) {
+        if(other.ptr) this->ptr.reset(new SexpExtra(*other.ptr));
+    }
+
+    auto SexpExtraPtr::operator=(SexpExtraPtr const& other) -> SexpExtraPtr& {
+        if(this != &other) this->ptr.reset(other.ptr ? new SexpExtra(*other.ptr) : nullptr);
+        return *this;
+    }
+
+    auto SexpExtraPtr::get() -> SexpExtra& {
+        if(!this->ptr) this->ptr.reset(new SexpExtra{});
+        return *this->ptr;
+    }
+
+    SexpHashSlot::SexpHashSlot(SexpHashSlot const& other) : value(other.value.load(std::memory_order_relaxed)) {}
+
+    // moves are not shared with other threads, so no read-modify-write is needed
+    SexpHashSlot::SexpHashSlot(SexpHashSlot&& other) noexcept : value(other.value.load(std::memory_order_relaxed)) {
+        other.clear();
+    }
+
+    auto SexpHashSlot::operator=(SexpHashSlot const& other) -> SexpHashSlot& {
+        this->value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        return *this;
+    }
+
+    auto SexpHashSlot::operator=(SexpHashSlot&& other) noexcept -> SexpHashSlot& {
+        this->value.store(other.value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        other.clear();
+        return *this;
+    }
+
+    auto SexpHashSlot::clear() -> void {
+        this->value.store(0, std::memory_order_relaxed);
+    }
+
+    static auto hasIndex(Sexp const& sexp) -> bool {
+        return sexp.extra.ptr && sexp.extra.ptr->index;
+    }
+
+    // brings the index of sexp up to date with its children, copying it first if another Sexp shares it
+    static auto currentIndex(Sexp& sexp) -> SexpIndex& {
+        auto& shared = sexp.extra.ptr->index;
+        if(shared.use_count() > 1) shared = std::make_shared<SexpIndex>(*shared);
+        auto& index = *shared;
+        if(index.count > sexp.value.sexp.size()) {
+            index.positions.clear();
+            index.count = 0;
+        }
+        uint64_t key;
+        for(; index.count < sexp.value.sexp.size(); ++index.count) {
+            if(indexKey(sexp.value.sexp[index.count], key)) index.positions[key].push_back(index.count);
+        }
+        return index;
+    }
+
     auto Sexp::addChild(Sexp sexp) -> void {
+        this->dirty = true;
+        this->structhash.clear();
         if(this->kind == SexpValueKind::ATOM) {
             this->kind = SexpValueKind::SEXP;
             this->value.sexp.push_back(Sexp{std::move(this->value.str), this->startpos, this->endpos});
         }
+        if(this->dotted && !this->value.sexp.empty()) {
+            // the tail stays last, so the positions after the new child move and the index starts over
+            this->value.sexp.insert(this->value.sexp.end() - 1, std::move(sexp));
+            if(hasIndex(*this)) this->extra.ptr->index = std::make_shared<SexpIndex>();
+            return;
+        }
         this->value.sexp.push_back(std::move(sexp));
+        if(hasIndex(*this) && this->extra.ptr->index->count == this->value.sexp.size() - 1) currentIndex(*this);
     }
 
     auto Sexp::addChild(std::string str) -> void {
@@ -132,85 +212,141 @@ namespace sexpresso {
         return std::move(paths);
     }
 
-    auto Sexp::getChildByPath(std::string const& path) -> Sexp* {
-        if(this->kind == SexpValueKind::ATOM) return nullptr;
+    // FNV-1a
+    auto hashString(char const* data, size_t size) -> uint64_t {
+        uint64_t hash = 14695981039346656037ull;
+        for(size_t i = 0; i < size; ++i) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
 
-        auto paths = splitPathString(path);
+    SexpPath::SexpPath(std::vector<std::string> segments) : segments(std::move(segments)) {
+        this->hashes.reserve(this->segments.size());
+        for(auto const& seg : this->segments) this->hashes.push_back(hashString(seg.data(), seg.size()));
+    }
 
-        auto* cur = this;
-        for(auto i = paths.begin(); i != paths.end();) {
-            auto start = i;
-            for(auto& child : cur->value.sexp) {
-                auto brk = false;
-                switch(child.kind) {
-                    case SexpValueKind::ATOM:
-                        if(i == paths.end() - 1 && child.value.str == *i) return &child;
-                        else continue;
-                    case SexpValueKind::SEXP:
-                        if(child.value.sexp.size() == 0) continue;
-                        auto& fst = child.value.sexp[0];
-                        switch(fst.kind) {
-                            case SexpValueKind::ATOM:
-                                if(fst.value.str == *i) {
-                                        cur = &child;
-                                        ++i;
-                                        brk = true;
-                                }
-                                break;
-                            case SexpValueKind::SEXP: continue;
-                        }
-                }
-                if(brk) break;
-            }
-            if(i == start) return nullptr;
-            if(i == paths.end()) return cur;
+    SexpPath::SexpPath(std::string const& path) : SexpPath(splitPathString(path)) {}
+
+    SexpPath::SexpPath(char const* path) : SexpPath(splitPathString(path)) {}
+
+    namespace literals {
+        auto operator"" _path(char const* path, size_t size) -> SexpPath {
+            return SexpPath{std::string{path, size}};
         }
-        return nullptr;
     }
 
-    static auto findChild(Sexp& sexp, std::string name) -> Sexp* {
-        auto findPred = [&name](Sexp& s) {
+    auto Sexp::getChildByPath(std::string const& path) -> Sexp* {
+        if(this->kind == SexpValueKind::ATOM) return nullptr;
+        return this->getChildByPath(SexpPath{path});
+    }
+
+    // first child that is a list headed by name, or, if atoms is set, an atom equal to name
+    static auto findChild(Sexp& sexp, std::string const& name, uint64_t hash, bool atoms) -> Sexp* {
+        auto matches = [&name, atoms](Sexp& s) {
             switch(s.kind) {
                 case SexpValueKind::SEXP: {
                     if(s.childCount() == 0) return false;
-                    auto& hd = s.getChild(0);
+                    auto& hd = s.value.sexp[0];
                     switch(hd.kind) {
                         case SexpValueKind::SEXP:
                             return false;
                         case SexpValueKind::ATOM:
-                            return hd.getString() == name;
+                            return hd.value.str == name;
                     }
                 }
                 case SexpValueKind::ATOM:
-                    return s.getString() == name;
+                    return atoms && s.value.str == name;
             }
+            return false;
         };
-        auto loc = std::find_if(sexp.value.sexp.begin(), sexp.value.sexp.end(), findPred);
+        if(sexp.kind != SexpValueKind::SEXP) return nullptr;
+        if(hasIndex(sexp)) {
+            auto& index = currentIndex(sexp);
+            auto found = index.positions.find(hash);
+            if(found == index.positions.end()) return nullptr;
+            for(auto pos : found->second) {
+                if(matches(sexp.value.sexp[pos])) return &sexp.value.sexp[pos];
+            }
+            return nullptr;
+        }
+        auto loc = std::find_if(sexp.value.sexp.begin(), sexp.value.sexp.end(), matches);
         if(loc == sexp.value.sexp.end()) return nullptr;
         else return &(*loc);
     }
-	
+
+    auto Sexp::getChildByPath(SexpPath const& path) -> Sexp* {
+        if(this->kind == SexpValueKind::ATOM) return nullptr;
+
+        // the result can be edited, so every node down to it forgets its hash
+        auto* cur = this;
+        for(size_t i = 0; i < path.segments.size(); ++i) {
+            // atoms only count as a match for the last segment
+            auto last = i == path.segments.size() - 1;
+            cur->structhash.clear();
+            cur = findChild(*cur, path.segments[i], path.hashes[i], last);
+            if(cur == nullptr) return nullptr;
+        }
+        cur->structhash.clear();
+        return path.segments.empty() ? nullptr : cur;
+    }
+
     auto Sexp::createPath(std::vector<std::string> const& path) -> Sexp& {
+        return this->createPath(SexpPath{path});
+    }
+
+    auto Sexp::createPath(std::string const& path) -> Sexp& {
+        return this->createPath(SexpPath{path});
+    }
+
+    auto Sexp::createPath(SexpPath const& path) -> Sexp& {
         auto el = this;
         auto nxt = el;
-        auto pc = path.begin();
-        for(; pc != path.end(); ++pc) {
-                nxt = findChild(*el, *pc);
+        size_t pc = 0;
+        for(; pc < path.segments.size(); ++pc) {
+                el->structhash.clear();
+                nxt = findChild(*el, path.segments[pc], path.hashes[pc], true);
                 if(nxt == nullptr) break;
                 else el = nxt;
         }
-        for(; pc != path.end(); ++pc) {
-                el->addChild(Sexp{std::vector<Sexp>{Sexp{*pc}}});
+        el->structhash.clear();
+        for(; pc < path.segments.size(); ++pc) {
+                el->addChild(Sexp{std::vector<Sexp>{Sexp{path.segments[pc]}}});
                 el = &(el->getChild(el->childCount()-1));
         }
         return *el;
     }
 
-    auto Sexp::createPath(std::string const& path) -> Sexp& {
-        return this->createPath(splitPathString(path));
+    auto Sexp::enableIndex() -> void {
+        if(!hasIndex(*this)) this->extra.get().index = std::make_shared<SexpIndex>();
+    }
+
+    auto Sexp::dropIndex() -> void {
+        if(this->extra.ptr) this->extra.ptr->index.reset();
     }
 
+    auto Sexp::index() const -> SexpIndex const* {
+        return hasIndex(*this) ? this->extra.ptr->index.get() : nullptr;
+    }
+
+    auto Sexp::symbolKind() const -> SexpSymbolKind {
+        return this->extra.ptr ? this->extra.ptr->symbolkind : SexpSymbolKind::NONE;
+    }
+
+    auto Sexp::packageId() const -> uint32_t {
+        return this->extra.ptr ? this->extra.ptr->packageid : 0;
+    }
+
+    auto Sexp::nameId() const -> uint32_t {
+        return this->extra.ptr ? this->extra.ptr->nameid : 0;
+    }
+
+    // The non-const accessors hand out something that can be edited, so the
+    // node and what they return forget their cached hashes.
     auto Sexp::getChild(size_t idx) -> Sexp& {
+        this->structhash.clear();
+        this->value.sexp[idx].structhash.clear();
         return this->value.sexp[idx];
     }
 
@@ -219,9 +355,21 @@ namespace sexpresso {
     }
 
     auto Sexp::getString() -> std::string& {
+        this->structhash.clear();
         return this->value.str;
     }
 
+    auto Sexp::getTail() -> Sexp* {
+        if(!this->dotted || this->value.sexp.empty()) return nullptr;
+        this->structhash.clear();
+        this->value.sexp.back().structhash.clear();
+        return &this->value.sexp.back();
+    }
+
+    auto Sexp::getTail() const -> Sexp const* {
+        return this->dotted && !this->value.sexp.empty() ? &this->value.sexp.back() : nullptr;
+    }
+
     static const std::array<char, 11> escape_chars = { '\'', '"',  '?', '\\',  'a',  'b',  'f',  'n',  'r',  't',  'v' };
     static const std::array<char, 11> escape_vals  = { '\'', '"', '\?', '\\', '\a', '\b', '\f', '\n', '\r', '\t', '\v' };
     static const std::array<int, 3> sexpkind_sizes = {0, 1, 2};
@@ -271,29 +419,24 @@ namespace sexpresso {
         return ("#p\"" + escape(s) + '"');
     }
 
+    static auto attributesToString(Sexp const& sexp, std::ostringstream& ostream) -> void {
+        for(SexpAttributeKind k : sexp.attributes) ostream << attributePrefix(k);
+    }
+
+    static auto sexpKindToString(Sexp const& sexp, std::ostringstream& ostream) -> void {
+        ostream << sexpKindPrefix(sexp.sexpkind);
+    }
+
+    // what follows child i when printing: a space, " . " before the tail of a
+    // dotted list, nothing after the last child
+    static auto childSeparator(Sexp const& sexp, std::vector<Sexp>::const_iterator i, std::ostringstream& ostream) -> void {
+        auto remaining = sexp.value.sexp.end() - i;
+        if(remaining == 1) return;
+        ostream << (sexp.dotted && remaining == 2 ? " . " : " ");
+    }
+
     static auto toStringImpl(Sexp const& sexp, std::ostringstream& ostream, SexpressoPrintMode printmode) -> void {
-        for(SexpAttributeKind k : sexp.attributes){
-            switch(k){
-            case SexpAttributeKind::QUOTE:
-                ostream << "'";
-                break;
-            case SexpAttributeKind::BACKQUOTE:
-                ostream << "`";
-                break;
-            case SexpAttributeKind::FUNCQUOTE:
-                ostream << "#'";
-                break;
-            case SexpAttributeKind::COMMASPLICE:
-                ostream << ",";
-                break;
-             case SexpAttributeKind::ATSPLICE:
-                ostream << ",@";
-                break;
-             case SexpAttributeKind::DOTSPLICE:
-                ostream << ",.";
-                break;
-            }
-        }
+        attributesToString(sexp, ostream);
         switch(sexp.kind) {
             case SexpValueKind::ATOM:
                 switch(sexp.atomkind){
@@ -314,16 +457,7 @@ namespace sexpresso {
                 }
             break;
 		case SexpValueKind::SEXP:
-            switch(sexp.sexpkind){
-                case SexpSexpKind::VECTOR:
-                    ostream << "#";
-                break;
-                case SexpSexpKind::COMPLEX:
-                    ostream << "#c";
-                break;
-
-                default:break;
-            }
+            sexpKindToString(sexp, ostream);
             if(printmode == SexpressoPrintMode::TOP_LEVEL_PARENS){
                 switch(sexp.value.sexp.size()) {
                 case 0:
@@ -338,7 +472,7 @@ namespace sexpresso {
                     ostream << '(';
                     for(auto i = sexp.value.sexp.begin(); i != sexp.value.sexp.end(); ++i) {
                         toStringImpl(*i, ostream,SexpressoPrintMode::TOP_LEVEL_PARENS);
-                        if(i != sexp.value.sexp.end()-1) ostream << ' ';
+                        childSeparator(sexp, i, ostream);
                     }
                     ostream << ')';
                 }
@@ -346,7 +480,7 @@ namespace sexpresso {
             else {
                 for(auto i = sexp.value.sexp.begin(); i != sexp.value.sexp.end(); ++i) {
                     toStringImpl(*i, ostream,SexpressoPrintMode::TOP_LEVEL_PARENS);
-                    if(i != sexp.value.sexp.end()-1) ostream << ' ';
+                    childSeparator(sexp, i, ostream);
                 }
             }
         }
@@ -358,6 +492,145 @@ namespace sexpresso {
             return ostream.str();
     }
 
+    struct SourceSpan { bool clean; size_t size; };
+
+    static auto hasSourceSpan(Sexp const& sexp, std::string const& source) -> bool {
+        return sexp.startpos >= 0 && sexp.endpos > sexp.startpos && static_cast<uint64_t>(sexp.endpos) <= source.size();
+    }
+
+    // one entry per node in pre-order: can the node be copied from source as is,
+    // and how many nodes its subtree holds so a copied subtree can be skipped
+    static auto markSourceSpans(Sexp const& sexp, std::string const& source, std::vector<SourceSpan>& spans) -> bool {
+        auto idx = spans.size();
+        spans.push_back(SourceSpan{false, 1});
+        auto clean = !sexp.dirty && hasSourceSpan(sexp, source);
+        if(sexp.kind == SexpValueKind::SEXP) {
+            for(auto const& child : sexp.value.sexp) {
+                auto childclean = markSourceSpans(child, source, spans);
+                clean = clean && childclean && child.startpos >= sexp.startpos && child.endpos <= sexp.endpos;
+            }
+        }
+        spans[idx].clean = clean;
+        spans[idx].size = spans.size() - idx;
+        return clean;
+    }
+
+    static auto skipBlank(char const*& p, char const* end) -> bool;
+
+    // only whitespace and comments in source between from and to, so no child
+    // that has since been taken out was there
+    static auto blankSource(std::string const& source, int64_t from, int64_t to) -> bool {
+        auto p = source.data() + from;
+        auto end = source.data() + to;
+        return skipBlank(p, end) && p == end;
+    }
+
+    static auto toStringFromSourceImpl(Sexp const& sexp, std::string const& source, std::vector<SourceSpan> const& spans, size_t& idx,
+                                       std::ostringstream& ostream, SexpressoPrintMode printmode) -> void {
+        auto& span = spans[idx];
+        if(span.clean) {
+            ostream.write(source.data() + sexp.startpos, sexp.endpos - sexp.startpos);
+            idx += span.size;
+            return;
+        }
+        ++idx;
+        if(sexp.kind == SexpValueKind::ATOM) {
+            toStringImpl(sexp, ostream, printmode);
+            return;
+        }
+        // A list still written as it was parsed keeps the text between children
+        // that are next to each other in both, comments included. Separators
+        // are generated only next to children that were added, taken out or
+        // moved, and where a dot was added or dropped.
+        auto header = std::ostringstream{};
+        attributesToString(sexp, header);
+        sexpKindToString(sexp, header);
+        if(printmode == SexpressoPrintMode::TOP_LEVEL_PARENS) header << '(';
+        auto opening = header.str();
+        auto closing = static_cast<int64_t>(printmode == SexpressoPrintMode::TOP_LEVEL_PARENS ? 1 : 0);
+        auto begin = sexp.startpos + static_cast<int64_t>(opening.size());
+        auto end = sexp.endpos - closing;
+        auto inplace = hasSourceSpan(sexp, source) && begin <= end && source.compare(static_cast<size_t>(sexp.startpos), opening.size(), opening) == 0
+                       && (closing == 0 || source[static_cast<size_t>(end)] == ')');
+        ostream << opening;
+        auto prevend = inplace ? begin : int64_t{-1}; // end of the last child copied from its place in the source
+        for(auto i = sexp.value.sexp.begin(); i != sexp.value.sexp.end(); ++i) {
+            auto original = inplace && hasSourceSpan(*i, source) && i->startpos >= begin && i->endpos <= end;
+            auto tail = sexp.dotted && i + 1 == sexp.value.sexp.end();
+            if(original && prevend >= 0 && prevend <= i->startpos && (!sexp.dirty || (!tail && blankSource(source, prevend, i->startpos)))) {
+                ostream.write(source.data() + prevend, i->startpos - prevend);
+            } else if(i != sexp.value.sexp.begin()) {
+                childSeparator(sexp, i - 1, ostream);
+            }
+            toStringFromSourceImpl(*i, source, spans, idx, ostream, SexpressoPrintMode::TOP_LEVEL_PARENS);
+            prevend = original ? i->endpos : int64_t{-1};
+        }
+        if(prevend >= 0 && prevend <= end && (!sexp.dirty || blankSource(source, prevend, end))) ostream.write(source.data() + prevend, end - prevend);
+        if(closing != 0) ostream << ')';
+    }
+
+    // source must be the string this tree was parsed from. Subtrees that are
+    // unmodified are copied from it verbatim, comments and layout included, and
+    // edited lists keep the layout around the children they still hold;
+    // printmode only matters when this node itself has to be regenerated.
+    auto Sexp::toString(std::string const& source, SexpressoPrintMode printmode) const -> std::string {
+        auto spans = std::vector<SourceSpan>{};
+        markSourceSpans(*this, source, spans);
+        auto ostream = std::ostringstream{};
+        size_t idx = 0;
+        toStringFromSourceImpl(*this, source, spans, idx, ostream, printmode);
+        return ostream.str();
+    }
+
+    static auto toCanonicalImpl(Sexp const& sexp, std::string& out, SexpressoPrintMode printmode) -> void {
+        switch(sexp.kind) {
+            case SexpValueKind::ATOM:
+                out.append(std::to_string(sexp.value.str.size()));
+                out.push_back(':');
+                out.append(sexp.value.str);
+                break;
+            case SexpValueKind::SEXP:
+                if(printmode == SexpressoPrintMode::TOP_LEVEL_PARENS) out.push_back('(');
+                for(auto const& child : sexp.value.sexp) toCanonicalImpl(child, out, SexpressoPrintMode::TOP_LEVEL_PARENS);
+                if(printmode == SexpressoPrintMode::TOP_LEVEL_PARENS) out.push_back(')');
+                break;
+        }
+    }
+
+    auto Sexp::toCanonical(SexpressoPrintMode printmode) const -> std::string {
+        auto out = std::string{};
+        toCanonicalImpl(*this, out, printmode);
+        return out;
+    }
+
+    static const char base64_chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    static auto base64Encode(std::string const& in) -> std::string {
+        auto out = std::string{};
+        out.reserve((in.size() + 2) / 3 * 4);
+        size_t i = 0;
+        for(; i + 2 < in.size(); i += 3) {
+            uint32_t n = (static_cast<uint8_t>(in[i]) << 16) | (static_cast<uint8_t>(in[i+1]) << 8) | static_cast<uint8_t>(in[i+2]);
+            out.push_back(base64_chars[(n >> 18) & 63]);
+            out.push_back(base64_chars[(n >> 12) & 63]);
+            out.push_back(base64_chars[(n >> 6) & 63]);
+            out.push_back(base64_chars[n & 63]);
+        }
+        if(i < in.size()) {
+            uint32_t n = static_cast<uint8_t>(in[i]) << 16;
+            if(i + 1 < in.size()) n |= static_cast<uint8_t>(in[i+1]) << 8;
+            out.push_back(base64_chars[(n >> 18) & 63]);
+            out.push_back(base64_chars[(n >> 12) & 63]);
+            out.push_back(i + 1 < in.size() ? base64_chars[(n >> 6) & 63] : '=');
+            out.push_back('=');
+        }
+        return out;
+    }
+
+    auto Sexp::toTransport(SexpressoPrintMode printmode) const -> std::string {
+        return '{' + base64Encode(this->toCanonical(printmode)) + '}';
+    }
+
     auto Sexp::isString() const -> bool {
         return this->kind == SexpValueKind::ATOM;
     }
@@ -383,13 +656,70 @@ namespace sexpresso {
         if(this->kind != other.kind) return false;
         switch(this->kind) {
             case SexpValueKind::SEXP:
-                return childrenEqual(this->value.sexp, other.value.sexp);
+                return this->dotted == other.dotted && childrenEqual(this->value.sexp, other.value.sexp);
             case SexpValueKind::ATOM:
                 return this->value.str == other.value.str;
         }
     }
 
+    static auto mixHash(uint64_t h) -> uint64_t {
+        h ^= h >> 30; h *= 0xbf58476d1ce4e5b9ull;
+        h ^= h >> 27; h *= 0x94d049bb133111ebull;
+        return h ^ (h >> 31);
+    }
+
+    auto hashCombine(uint64_t seed, uint64_t value) -> uint64_t {
+        return mixHash(seed ^ (value + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2)));
+    }
+
+    auto Sexp::hash() const -> uint64_t {
+        auto h = this->structhash.value.load(std::memory_order_relaxed);
+        if(h != 0) return h;
+        h = structuralHash(*this, this->value.str, this->value.sexp, [](Sexp const& child) { return child.hash(); });
+        this->structhash.value.store(h, std::memory_order_relaxed);
+        return h;
+    }
+
+    auto Sexp::dropHash() -> void {
+        this->structhash.clear();
+        for(auto& child : this->value.sexp) child.dropHash();
+    }
+
+    static auto fieldsEqual(Sexp const& a, Sexp const& b) -> bool {
+        auto ha = a.structhash.value.load(std::memory_order_relaxed);
+        auto hb = b.structhash.value.load(std::memory_order_relaxed);
+        if(ha != 0 && hb != 0 && ha != hb) return false;
+        if(a.kind != b.kind || a.sexpkind != b.sexpkind || a.atomkind != b.atomkind || a.dotted != b.dotted || a.attributes != b.attributes) return false;
+        switch(a.kind) {
+            case SexpValueKind::SEXP:
+                if(a.value.sexp.size() != b.value.sexp.size()) return false;
+                for(size_t i = 0; i < a.value.sexp.size(); ++i) {
+                    if(!fieldsEqual(a.value.sexp[i], b.value.sexp[i])) return false;
+                }
+                return true;
+            case SexpValueKind::ATOM:
+                return a.value.str == b.value.str;
+        }
+        return false;
+    }
+
+    auto Sexp::strictEqual(Sexp const& other) const -> bool {
+        if(this == &other) return true;
+        if(this->hash() != other.hash()) return false;
+        return fieldsEqual(*this, other);
+    }
+
+    auto Sexp::operator==(Sexp const& other) const -> bool {
+        return this->strictEqual(other);
+    }
+
+    auto Sexp::operator!=(Sexp const& other) const -> bool {
+        return !this->strictEqual(other);
+    }
+
     auto Sexp::arguments() -> SexpArgumentIterator {
+        this->structhash.clear();
+        for(auto& child : this->value.sexp) child.structhash.clear();
         return SexpArgumentIterator{*this};
     }
 
@@ -446,6 +776,327 @@ namespace sexpresso {
         return initial - adjustment;
     }
 
+    // the . of (a . b), not a symbol that merely contains dots
+    static auto isDot(Sexp const& sexp) -> bool {
+        return sexp.kind == SexpValueKind::ATOM && sexp.atomkind == SexpAtomKind::SYMBOL && sexp.attributes.empty() && sexp.value.str == ".";
+    }
+
+    static auto isDelimiter(char c) -> bool {
+        return std::isspace(static_cast<unsigned char>(c)) || c == '(' || c == ')';
+    }
+
+    // Skips whitespace, ; comments and nested #| |# comments. False if a block
+    // comment is not closed.
+    static auto skipBlank(char const*& p, char const* end) -> bool {
+        while(p != end) {
+            if(std::isspace(static_cast<unsigned char>(*p))) { ++p; continue; }
+            if(*p == ';') {
+                for(; p != end && *p != '\n' && *p != '\r'; ++p) {}
+                continue;
+            }
+            if(*p == '#' && p + 1 != end && p[1] == '|') {
+                int depth = 0;
+                for(; p + 1 < end; ++p) {
+                    if(p[0] == '#' && p[1] == '|') { ++depth; ++p; }
+                    else if(p[0] == '|' && p[1] == '#') { ++p; if(--depth == 0) break; }
+                }
+                if(depth != 0) return false;
+                ++p;
+                continue;
+            }
+            break;
+        }
+        return true;
+    }
+
+    static auto skipString(char const*& p, char const* end) -> bool {
+        for(++p; p != end; ++p) {
+            if(*p == '\\' && p + 1 != end) { ++p; continue; }
+            if(*p == '"') { ++p; return true; }
+        }
+        return false;
+    }
+
+    static auto evalFeature(char const*& p, char const* end, SexpParseOptions const& options, bool& value, std::string& err) -> bool;
+
+    // Steps over one form without building it, matching brackets and minding
+    // strings, comments and character literals. A #+ or #- in front of it is
+    // evaluated as the reader would: when it drops its own form, the form
+    // after that is the one skipped, so #+(or) #+(or) a b skips both. False
+    // if the input ends first, or with err set for a bad feature expression.
+    static auto skipForm(char const*& p, char const* end, SexpParseOptions const& options, std::string& err) -> bool {
+        while(true) {
+            if(!skipBlank(p, end) || p == end) return false;
+            if(*p == '\'' || *p == '`') { ++p; continue; }
+            if(*p == ',') { ++p; if(p != end && (*p == '@' || *p == '.')) ++p; continue; }
+            if(*p == '#' && p + 1 != end && p[1] == '\'') { p += 2; continue; }
+            if(*p == '#' && p + 1 != end && (p[1] == '+' || p[1] == '-')) {
+                auto keep = p[1] == '+';
+                auto value = false;
+                p += 2;
+                if(!evalFeature(p, end, options, value, err)) return false;
+                if(value != keep && !skipForm(p, end, options, err)) return false;
+                continue;
+            }
+            break;
+        }
+        if(*p == '#' && p + 1 != end) {
+            switch(p[1]) {
+                case '\\':
+                    if(end - p < 3) { p = end; return false; }
+                    p += 3;
+                    for(; p != end && !isDelimiter(*p); ++p) {}
+                    return true;
+                case '(': ++p; break;
+                case 'c': case 'C': if(p + 2 != end && p[2] == '(') p += 2; break;
+                case 'p': case 'P': if(p + 2 != end && p[2] == '"') p += 2; break;
+            }
+        }
+        if(*p == '"') return skipString(p, end);
+        if(*p == ')') return false;
+        if(*p != '(') {
+            for(; p != end && !isDelimiter(*p); ++p) {}
+            return true;
+        }
+        size_t depth = 0;
+        while(p != end) {
+            switch(*p) {
+                case '"':
+                    if(!skipString(p, end)) return false;
+                    continue;
+                case ';':
+                case '#':
+                    if(*p == '#' && p + 1 != end && p[1] == '\\') {
+                        p = end - p > 3 ? p + 3 : end;
+                        continue;
+                    }
+                    if(*p == ';' || (p + 1 != end && p[1] == '|')) {
+                        if(!skipBlank(p, end)) return false;
+                        continue;
+                    }
+                    break;
+                case '(': ++depth; break;
+                case ')':
+                    if(--depth == 0) { ++p; return true; }
+                    break;
+            }
+            ++p;
+        }
+        return false;
+    }
+
+    static auto featureName(char const*& p, char const* end) -> std::string {
+        auto start = p;
+        for(; p != end && !isDelimiter(*p); ++p) {}
+        auto name = std::string{start, p};
+        if(!name.empty() && name[0] == ':') name.erase(0, 1);
+        for(auto& c : name) c = static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        return name;
+    }
+
+    static auto evalFeature(char const*& p, char const* end, SexpParseOptions const& options, bool& value, std::string& err) -> bool {
+        if(!skipBlank(p, end) || p == end) {
+            err = std::string{"Unterminated feature expression"};
+            return false;
+        }
+        if(*p == ')') {
+            err = std::string{"Missing feature expression"};
+            return false;
+        }
+        if(*p != '(') {
+            value = options.features.count(featureName(p, end)) != 0;
+            return true;
+        }
+        ++p;
+        skipBlank(p, end);
+        auto op = featureName(p, end);
+        if(op != "and" && op != "or" && op != "not") {
+            err = std::string{"Unknown feature expression operator :"} + op;
+            return false;
+        }
+        value = op != "or";
+        size_t operands = 0;
+        while(true) {
+            if(!skipBlank(p, end) || p == end) {
+                err = std::string{"Unterminated feature expression"};
+                return false;
+            }
+            if(*p == ')') { ++p; break; }
+            auto operand = false;
+            if(!evalFeature(p, end, options, operand, err)) return false;
+            ++operands;
+            if(op == "and") value = value && operand;
+            else if(op == "or") value = value || operand;
+            else value = !operand;
+        }
+        if(op == "not" && operands != 1) {
+            err = std::string{"(:not) takes exactly one feature expression"};
+            return false;
+        }
+        return true;
+    }
+
+    SexpSymbolTable::SexpSymbolTable() {
+        this->intern(std::string{});
+    }
+
+    auto SexpSymbolTable::intern(std::string const& name) -> uint32_t {
+        auto found = this->ids.find(name);
+        if(found != this->ids.end()) return found->second;
+        auto id = static_cast<uint32_t>(this->names.size());
+        this->names.push_back(name);
+        this->ids.emplace(name, id);
+        return id;
+    }
+
+    auto SexpSymbolTable::find(std::string const& name) const -> uint32_t {
+        auto found = this->ids.find(name);
+        return found != this->ids.end() ? found->second : 0;
+    }
+
+    auto SexpSymbolTable::name(uint32_t id) const -> std::string const& {
+        return this->names[id];
+    }
+
+    auto SexpSymbolTable::size() const -> size_t {
+        return this->names.size();
+    }
+
+    // Macro characters, and the close character of readDelimited, end a
+    // symbol the way whitespace and parens do.
+    static auto endsToken(char c, SexpReadtable const* readtable, char close) -> bool {
+        return isDelimiter(c) || (close != '\0' && c == close) || (readtable != nullptr && readtable->macros[static_cast<unsigned char>(c)]);
+    }
+
+    // End of a symbol token that may hold |escaped parts| and \ escapes.
+    static auto symbolEnd(std::string::const_iterator i, std::string::const_iterator end, SexpReadtable const* readtable, char close) -> std::string::const_iterator {
+        auto inbar = false;
+        for(auto first = i; i != end; ++i) {
+            if(*i == '\\') {
+                if(i + 1 == end) break;
+                ++i;
+            } else if(*i == '|') {
+                inbar = !inbar;
+            } else if(!inbar && (isDelimiter(*i) || (i != first && endsToken(*i, readtable, close)))) {
+                break;
+            }
+        }
+        return i;
+    }
+
+    // Runs a read macro found at iter and adds what it read to the open list.
+    // False with err set if the macro failed.
+    static auto readMacro(SexpReadMacro const& macro, std::string const& str, std::string::const_iterator iter, std::string::const_iterator& nextiter,
+                          std::stack<Sexp>& sexprstack, std::vector<SexpAttributeKind>& attribs, std::string& err) -> bool {
+        auto start = static_cast<size_t>(iter - str.begin());
+        auto pos = start;
+        auto result = Sexp{};
+        auto outcome = macro(str, pos, result, err);
+        if(outcome == SexpMacroResult::ERROR) {
+            if(err.empty()) err = std::string{"read macro failed"};
+            return false;
+        }
+        if(pos <= start || pos > str.size()) {
+            err = std::string{"read macro did not move past its macro character"};
+            return false;
+        }
+        nextiter = str.begin() + static_cast<std::ptrdiff_t>(pos);
+        if(outcome == SexpMacroResult::NONE) return true;
+        result.startpos = adjustStartPos(static_cast<long long>(start), SexpAtomKind::NONE, SexpSexpKind::NONE, attribs);
+        result.endpos = static_cast<int64_t>(pos);
+        result.attributes.insert(result.attributes.begin(), attribs.begin(), attribs.end());
+        attribs.clear();
+        result.dropHash(); // the macro may have edited what it read after it was hashed
+        sexprstack.top().addChild(std::move(result));
+        return true;
+    }
+
+    static auto foldCase(char c, SexpReadCase readcase) -> char {
+        auto u = static_cast<unsigned char>(c);
+        switch(readcase) {
+            case SexpReadCase::UPCASE: return static_cast<char>(std::toupper(u));
+            case SexpReadCase::DOWNCASE: return static_cast<char>(std::tolower(u));
+            case SexpReadCase::INVERT: return static_cast<char>(std::isupper(u) ? std::tolower(u) : std::toupper(u));
+            case SexpReadCase::PRESERVE: break;
+        }
+        return c;
+    }
+
+    // Splits a symbol token into package and name, resolving escapes and
+    // folding case, and interns both.
+    static auto classifySymbol(Sexp& sexp, char const* begin, char const* end, SexpParseOptions const& options) -> void {
+        if(begin == end) return;
+        auto first = begin[0];
+        auto second = end - begin > 1 ? begin[1] : '\0';
+        if(std::isdigit(static_cast<unsigned char>(first))) return;
+        if((first == '+' || first == '-' || first == '.') && std::isdigit(static_cast<unsigned char>(second))) return;
+
+        auto kind = SexpSymbolKind::PLAIN;
+        auto p = begin;
+        if(first == ':') {
+            kind = SexpSymbolKind::KEYWORD;
+            ++p;
+        } else if(first == '#' && second == ':') {
+            kind = SexpSymbolKind::UNINTERNED;
+            p += 2;
+        }
+
+        auto readcase = options.readcase;
+        if(readcase == SexpReadCase::INVERT) {
+            // invert only when all unescaped letters have the same case
+            auto upper = false, lower = false, inbar = false;
+            for(auto q = p; q != end; ++q) {
+                if(*q == '\\') { ++q; if(q == end) break; continue; }
+                if(*q == '|') { inbar = !inbar; continue; }
+                if(inbar) continue;
+                upper = upper || std::isupper(static_cast<unsigned char>(*q));
+                lower = lower || std::islower(static_cast<unsigned char>(*q));
+            }
+            if(upper && lower) readcase = SexpReadCase::PRESERVE;
+        }
+
+        std::string parts[2];
+        size_t part = 0;
+        auto inbar = false;
+        for(; p != end; ++p) {
+            auto c = *p;
+            if(c == '\\' && p + 1 != end) {
+                parts[part].push_back(*++p);
+            } else if(c == '|') {
+                inbar = !inbar;
+            } else if(inbar) {
+                parts[part].push_back(c);
+            } else if(c == ':' && part == 0 && kind == SexpSymbolKind::PLAIN) {
+                part = 1;
+                kind = SexpSymbolKind::EXTERNAL;
+                if(p + 1 != end && p[1] == ':') {
+                    kind = SexpSymbolKind::INTERNAL;
+                    ++p;
+                }
+            } else {
+                parts[part].push_back(foldCase(c, readcase));
+            }
+        }
+        auto& table = *options.symbols;
+        auto& extra = sexp.extra.get();
+        extra.symbolkind = kind;
+        if(part == 1) {
+            extra.packageid = table.intern(parts[0]);
+            extra.nameid = table.intern(parts[1]);
+        } else {
+            extra.packageid = 0;
+            extra.nameid = table.intern(parts[0]);
+        }
+    }
+
+    auto SexpReadtable::setMacroCharacter(char c, SexpReadMacro macro) -> void {
+        this->macros[static_cast<unsigned char>(c)] = std::move(macro);
+    }
+
+    auto SexpReadtable::setDispatchMacroCharacter(char sub, SexpReadMacro macro) -> void {
+        this->dispatch[static_cast<unsigned char>(sub)] = std::move(macro);
+    }
+
     auto parse(std::string const& str) -> Sexp {
         auto ignored_error = std::string{};
         return parse(str, ignored_error);
@@ -457,9 +1108,34 @@ namespace sexpresso {
     }
 
     auto parse(std::string const& str, std::string& err, std::string& errsymbol) -> Sexp {
+        static const SexpParseOptions default_options{};
+        return parse(str, err, errsymbol, default_options);
+    }
+
+    auto parse(std::string const& str, std::string& err, SexpParseOptions const& options) -> Sexp {
+        std::string errsymbol = ":sexpresso-error";
+        return parse(str, err, errsymbol, options);
+    }
+
+    static auto parseFrom(std::string const& str, size_t& pos, char close, std::string& err, std::string& errsymbol, SexpParseOptions const& options) -> Sexp;
+
+    auto parse(std::string const& str, std::string& err, std::string& errsymbol, SexpParseOptions const& options) -> Sexp {
+        size_t pos = 0;
+        return parseFrom(str, pos, '\0', err, errsymbol, options);
+    }
+
+    auto readDelimited(std::string const& str, size_t& pos, char close, std::string& err, SexpParseOptions const& options) -> Sexp {
+        std::string errsymbol = ":sexpresso-error";
+        return parseFrom(str, pos, close, err, errsymbol, options);
+    }
+
+    // Reads from pos to the end of str, or with close set, to the first close
+    // outside any list, and leaves pos after what it read.
+    static auto parseFrom(std::string const& str, size_t& pos, char close, std::string& err, std::string& errsymbol, SexpParseOptions const& options) -> Sexp {
         auto sexprstack = std::stack<Sexp>{};
-        sexprstack.push(Sexp(0)); // root
-        auto nextiter = str.begin();
+        sexprstack.push(Sexp(static_cast<int64_t>(pos))); // root
+        auto nextiter = str.begin() + static_cast<std::ptrdiff_t>(pos);
+        auto closed = false;
 
         SexpAtomKind atomkind = SexpAtomKind::NONE;
         SexpSexpKind sexpkind = SexpSexpKind::NONE;
@@ -485,7 +1161,22 @@ namespace sexpresso {
             }
 
             if(std::isspace(static_cast<unsigned char>(*iter))) continue;
+            if(close != '\0' && sexprstack.size() == 1 && (*iter == close || *iter == ')')) {
+                closed = *iter == close; // a ) here belongs to an enclosing list, so close is missing
+                pos = static_cast<size_t>(iter - str.begin());
+                break;
+            }
             auto& cursexp = sexprstack.top();
+            if(options.readtable != nullptr && options.readtable->macros[static_cast<unsigned char>(*iter)]) {
+                if(!readMacro(options.readtable->macros[static_cast<unsigned char>(*iter)], str, iter, nextiter, sexprstack, attribs, err)) {
+                    int64_t len = static_cast<int64_t>(str.length() + errsymbol.length());
+                    sexprstack.top().addChild(Sexp{errsymbol, static_cast<int64_t>(str.length()), len});
+
+                    closeStack(sexprstack);
+                    return std::move(sexprstack.top());
+                }
+                continue;
+            }
             switch(*iter) {
             case '(': {
                 auto startpos = adjustStartPos(iter - str.begin(), atomkind, sexpkind, attribs);
@@ -507,6 +1198,13 @@ namespace sexpresso {
                     return std::move(topsexp);
                 }
                 topsexp.endpos = nextiter - str.begin();
+                auto& items = topsexp.value.sexp;
+                if(topsexp.sexpkind == SexpSexpKind::NONE && items.size() >= 3 && isDot(items[items.size() - 2])) {
+                    items.erase(items.end() - 2);
+                    topsexp.dotted = true;
+                }
+                topsexp.dirty = false;
+                topsexp.hash();
                 auto& top = sexprstack.top();
                 top.addChild(std::move(topsexp));
                 break;
@@ -622,6 +1320,17 @@ namespace sexpresso {
                 bool willbreak = false;
                 if(nextiter == str.end()) break;
 
+                if(options.readtable != nullptr && options.readtable->dispatch[static_cast<unsigned char>(*nextiter)]) {
+                    if(!readMacro(options.readtable->dispatch[static_cast<unsigned char>(*nextiter)], str, iter, nextiter, sexprstack, attribs, err)) {
+                        int64_t len = static_cast<int64_t>(str.length() + errsymbol.length());
+                        sexprstack.top().addChild(Sexp{errsymbol, static_cast<int64_t>(str.length()), len});
+
+                        closeStack(sexprstack);
+                        return std::move(sexprstack.top());
+                    }
+                    break;
+                }
+
                 switch(*nextiter){
                     case '\'': {
                         attribs.push_back(SexpAttributeKind::FUNCQUOTE);
@@ -702,6 +1411,42 @@ namespace sexpresso {
                         }
                         nextiter = nexti + 1;
                         willbreak = true;
+                        break;
+                    }
+                    case '+':
+                    case '-': {
+                        if(!options.featureExpressions) break;
+                        auto end = str.data() + str.size();
+                        auto p = str.data() + (nextiter - str.begin()) + 1;
+                        auto value = false;
+                        auto keep = *nextiter == '+';
+                        if(evalFeature(p, end, options, value, err) && value != keep && !skipForm(p, end, options, err) && err.empty()) {
+                            err = std::string{"Missing form after feature expression"};
+                        }
+                        if(!err.empty()) {
+                            int64_t len = static_cast<int64_t>(str.length() + errsymbol.length());
+                            sexprstack.top().addChild(Sexp{errsymbol, static_cast<int64_t>(str.length()), len});
+
+                            closeStack(sexprstack);
+                            return std::move(sexprstack.top());
+                        }
+                        nextiter = str.begin() + (p - str.data());
+                        willbreak = true;
+                        break;
+                    }
+                    case '0': case '1': case '2': case '3': case '4':
+                    case '5': case '6': case '7': case '8': case '9': {
+                        if(!options.labels) break;
+                        auto labelend = std::find_if(nextiter, str.end(), [](char c) { return !std::isdigit(static_cast<unsigned char>(c)); });
+                        if(labelend == str.end() || (*labelend != '=' && *labelend != '#')) break;
+                        ++labelend;
+                        auto startpos = adjustStartPos(iter - str.begin(), atomkind, sexpkind, attribs);
+                        cursexp.addChild(Sexp{std::string{iter, labelend}, startpos, labelend - str.begin()});
+                        cursexp.value.sexp.back().attributes = attribs;
+                        attribs.clear();
+                        nextiter = labelend;
+                        willbreak = true;
+                        break;
                     }
                 }
                 if(willbreak) break;
@@ -709,13 +1454,18 @@ namespace sexpresso {
             }
              default:
 
-                auto symend = std::find_if(iter, str.end(), [](char const& c) { return std::isspace(static_cast<unsigned char>(c)) || c == ')' || c == '('; });
+                auto classify = options.symbols != nullptr && atomkind == SexpAtomKind::NONE;
+                auto readtable = options.readtable;
+                auto symend = classify ? symbolEnd(iter, str.end(), readtable, close)
+                            : readtable != nullptr || close != '\0' ? std::find_if(iter + 1, str.end(), [readtable, close](char const& c) { return endsToken(c, readtable, close); })
+                                                                    : std::find_if(iter, str.end(), [](char const& c) { return std::isspace(static_cast<unsigned char>(c)) || c == ')' || c == '('; });
                 auto& top = sexprstack.top();
                 auto endpos = symend - str.begin();
                 auto startpos = adjustStartPos(iter - str.begin(), atomkind, sexpkind, attribs);
                 top.addChild(Sexp{std::string{iter, symend}, startpos, endpos});
                 top.value.sexp.back().attributes = attribs;
                 attribs.clear();
+                if(classify) classifySymbol(top.value.sexp.back(), str.data() + (iter - str.begin()), str.data() + endpos, options);
                 if(atomkind != SexpAtomKind::NONE){
                     top.value.sexp.back().atomkind = atomkind;
                     atomkind = SexpAtomKind::NONE;
@@ -731,9 +1481,149 @@ namespace sexpresso {
             sexprstack.top().addChild(Sexp{errsymbol, static_cast<int64_t>(str.length() + 1), len});
             closeStack(sexprstack);
         }
+        else if(close != '\0' && !closed) {
+            err = std::string{"Unterminated read macro, expected '"} + close + '\'';
+            int64_t len = static_cast<int64_t>(str.length() + errsymbol.length());
+            sexprstack.top().addChild(Sexp{errsymbol, static_cast<int64_t>(str.length()), len});
+        }
+        else {
+            sexprstack.top().endpos = closed ? static_cast<int64_t>(pos) : static_cast<int64_t>(str.length());
+            sexprstack.top().dirty = false;
+            sexprstack.top().hash();
+        }
+        pos = closed ? pos + 1 : str.size();
+        return std::move(sexprstack.top());
+    }
+
+    static auto base64Decode(char const* begin, char const* end, std::string& out) -> bool {
+        uint32_t n = 0;
+        int bits = 0;
+        for(auto p = begin; p != end; ++p) {
+            auto c = *p;
+            if(std::isspace(static_cast<unsigned char>(c))) continue;
+            if(c == '=') break;
+            auto loc = std::strchr(base64_chars, c);
+            if(loc == nullptr || c == '\0') return false;
+            n = (n << 6) | static_cast<uint32_t>(loc - base64_chars);
+            bits += 6;
+            if(bits >= 8) {
+                bits -= 8;
+                out.push_back(static_cast<char>((n >> bits) & 0xff));
+            }
+        }
+        return true;
+    }
+
+    // atoms that would survive the text parser as a bare token come back as
+    // symbols, everything else as strings so toString() quotes them
+    static auto canonicalAtomKind(char const* begin, char const* end) -> SexpAtomKind {
+        if(begin == end) return SexpAtomKind::STRING;
+        for(auto p = begin; p != end; ++p) {
+            auto c = static_cast<unsigned char>(*p);
+            if(std::isspace(c) || c == '(' || c == ')' || c == '"' || c == ';' || c == '\'' || c == '`' || c == ',' || c == '#' || c == '\\' || c < 0x20) {
+                return SexpAtomKind::STRING;
+            }
+        }
+        return SexpAtomKind::SYMBOL;
+    }
+
+    static auto setCanonicalPositions(Sexp& sexp, int64_t startpos, int64_t endpos) -> void {
+        sexp.startpos = startpos;
+        sexp.endpos = endpos;
+        for(auto& child : sexp.value.sexp) setCanonicalPositions(child, startpos, endpos);
+    }
+
+    static auto parseCanonicalImpl(char const* begin, char const* end, std::string& err) -> Sexp {
+        auto sexprstack = std::stack<Sexp>{};
+        sexprstack.push(Sexp(0, end - begin)); // root
+        auto p = begin;
+        while(p != end && err.empty()) {
+            auto startpos = static_cast<int64_t>(p - begin);
+            switch(*p) {
+            case '(':
+                sexprstack.push(Sexp(startpos));
+                ++p;
+                break;
+            case ')': {
+                if(sexprstack.size() == 1) {
+                    err = std::string{"too many ')' characters in canonical s-expression"};
+                    break;
+                }
+                auto topsexp = std::move(sexprstack.top());
+                sexprstack.pop();
+                topsexp.endpos = startpos + 1;
+                sexprstack.top().addChild(std::move(topsexp));
+                ++p;
+                break;
+            }
+            case '{': {
+                auto close = std::find(p + 1, end, '}');
+                auto decoded = std::string{};
+                if(close == end || !base64Decode(p + 1, close, decoded)) {
+                    err = std::string{"invalid transport block in canonical s-expression"};
+                    break;
+                }
+                auto inner = parseCanonicalImpl(decoded.data(), decoded.data() + decoded.size(), err);
+                for(auto& child : inner.value.sexp) {
+                    setCanonicalPositions(child, startpos, close + 1 - begin);
+                    sexprstack.top().addChild(std::move(child));
+                }
+                p = close + 1;
+                break;
+            }
+            case '[': {
+                // display hints are accepted but not kept, Sexp has nowhere to store them
+                auto close = std::find(p + 1, end, ']');
+                if(close == end) {
+                    err = std::string{"unterminated display hint in canonical s-expression"};
+                    break;
+                }
+                p = close + 1;
+                break;
+            }
+            default: {
+                uint64_t len = 0;
+                auto digits = p;
+                for(; p != end && *p >= '0' && *p <= '9'; ++p) {
+                    if(len > (UINT64_MAX - 9) / 10) break;
+                    len = len * 10 + static_cast<uint64_t>(*p - '0');
+                }
+                if(p == digits || p == end || *p != ':') {
+                    err = std::string{"expected a length prefix in canonical s-expression"};
+                    break;
+                }
+                ++p;
+                if(len > static_cast<uint64_t>(end - p)) {
+                    err = std::string{"atom length exceeds canonical s-expression"};
+                    break;
+                }
+                auto atomend = p + len;
+                sexprstack.top().addChild(Sexp::unescaped(std::string{p, atomend}, canonicalAtomKind(p, atomend), startpos, atomend - begin));
+                p = atomend;
+            }
+            }
+        }
+        if(sexprstack.size() != 1 && err.empty()) {
+            err = std::string{"not enough s-expressions were closed by the end of parsing"};
+        }
+        while(sexprstack.size() != 1) {
+            auto topsexp = std::move(sexprstack.top());
+            sexprstack.pop();
+            topsexp.endpos = p - begin;
+            sexprstack.top().addChild(std::move(topsexp));
+        }
         return std::move(sexprstack.top());
     }
 
+    auto parseCanonical(std::string const& str) -> Sexp {
+        auto ignored_error = std::string{};
+        return parseCanonical(str, ignored_error);
+    }
+
+    auto parseCanonical(std::string const& str, std::string& err) -> Sexp {
+        return parseCanonicalImpl(str.data(), str.data() + str.size(), err);
+    }
+
     auto escape(std::string const& str) -> std::string {
         auto escape_count = countEscapeValues(str);
         if(escape_count == 0) return str;
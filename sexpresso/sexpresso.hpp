@@ -5,6 +5,12 @@
 #include <vector>
 #include <string>
 #include <cstdint>
+#include <memory>
+#include <atomic>
+#include <array>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
 
 namespace sexpresso {
     enum class SexpValueKind : uint8_t { SEXP, ATOM };
@@ -12,8 +18,72 @@ namespace sexpresso {
     enum class SexpAtomKind : uint8_t { NONE, SYMBOL, STRING, CHAR, BINARY, OCTAL, HEX, PATHNAME };
     enum class SexpAttributeKind : uint8_t { QUOTE, BACKQUOTE, FUNCQUOTE, COMMASPLICE, ATSPLICE, DOTSPLICE };
     enum class SexpressoPrintMode : uint8_t { NO_TOPLEVEL_PARENS, TOP_LEVEL_PARENS };
+    enum class SexpSymbolKind : uint8_t { NONE, PLAIN, KEYWORD, EXTERNAL, INTERNAL, UNINTERNED };
+    enum class SexpReadCase : uint8_t { PRESERVE, UPCASE, DOWNCASE, INVERT };
 	struct SexpArgumentIterator;
 
+	// A path for getChildByPath/createPath split once up front, so repeated
+	// lookups of the same path do not allocate.
+	struct SexpPath {
+		explicit SexpPath(std::string const& path);
+		explicit SexpPath(char const* path);
+		explicit SexpPath(std::vector<std::string> segments);
+		std::vector<std::string> segments;
+		std::vector<uint64_t> hashes; // hashString() of each segment
+	};
+	auto hashString(char const* data, size_t size) -> uint64_t;
+	auto hashCombine(uint64_t seed, uint64_t value) -> uint64_t; // mixes value into seed, used by Sexp::hash()
+
+	// Interned symbol and package names, see SexpParseOptions::symbols. Id 0 is
+	// the empty string and stands for no package.
+	struct SexpSymbolTable {
+		SexpSymbolTable();
+		auto intern(std::string const& name) -> uint32_t;
+		auto find(std::string const& name) const -> uint32_t; // 0 if never interned
+		auto name(uint32_t id) const -> std::string const&;
+		auto size() const -> size_t;
+		std::vector<std::string> names;
+		std::unordered_map<std::string, uint32_t> ids;
+	};
+
+	// Head symbol -> child positions of one list, so path lookups on lists with
+	// many children do not have to scan them. See Sexp::enableIndex().
+	struct SexpIndex {
+		std::unordered_map<uint64_t, std::vector<size_t>> positions; // keyed by hashString() of the head symbol or atom
+		size_t count = 0; // children indexed so far
+	};
+
+	// What only some nodes carry, kept out of line so the others stay small.
+	struct SexpExtra {
+		std::shared_ptr<SexpIndex> index; // shared with copies until one of them changes
+		SexpSymbolKind symbolkind = SexpSymbolKind::NONE; // set by parse() with options.symbols, like the ids below
+		uint32_t packageid = 0; // SexpSymbolTable id of the package, 0 for none
+		uint32_t nameid = 0;    // SexpSymbolTable id of the name, escapes resolved and case folded
+	};
+
+	// Owns a node's SexpExtra, if it has one, and copies it with the node.
+	struct SexpExtraPtr {
+		SexpExtraPtr() = default;
+		SexpExtraPtr(SexpExtraPtr const& other);
+		SexpExtraPtr(SexpExtraPtr&& other) = default;
+		auto operator=(SexpExtraPtr const& other) -> SexpExtraPtr&;
+		auto operator=(SexpExtraPtr&& other) -> SexpExtraPtr& = default;
+		auto get() -> SexpExtra&; // created on first use
+		std::unique_ptr<SexpExtra> ptr;
+	};
+
+	// Sexp::hash() of one node once computed, 0 until then. Atomic so threads
+	// sharing a const tree can fill it in; a move takes it along.
+	struct SexpHashSlot {
+		SexpHashSlot() = default;
+		SexpHashSlot(SexpHashSlot const& other);
+		SexpHashSlot(SexpHashSlot&& other) noexcept;
+		auto operator=(SexpHashSlot const& other) -> SexpHashSlot&;
+		auto operator=(SexpHashSlot&& other) noexcept -> SexpHashSlot&;
+		auto clear() -> void;
+		std::atomic<uint64_t> value{0};
+	};
+
 	struct Sexp {
 		Sexp();
         Sexp(int64_t startpos, int64_t endpos = 0);
@@ -26,11 +96,15 @@ namespace sexpresso {
 		SexpValueKind kind;
         SexpSexpKind sexpkind;
         SexpAtomKind atomkind;
+        bool dirty = false; // set by addChild/createPath, set it yourself after editing value directly
+        bool dotted = false; // (a b . c): the last child is the tail after the dot, so this list has three children
         std::vector<SexpAttributeKind> attributes;
-        int64_t startpos;
-        int64_t endpos;
-        struct { std::vector<Sexp> sexp; std::string str; int64_t startpos; int64_t endpos = 0;} value;
-		auto addChild(Sexp sexp) -> void;
+        int64_t startpos = 0;
+        int64_t endpos = 0;
+        struct { std::vector<Sexp> sexp; std::string str; int64_t startpos = 0; int64_t endpos = 0;} value;
+        SexpExtraPtr extra; // empty unless an index is enabled or the atom is a classified symbol
+        mutable SexpHashSlot structhash; // see hash()
+		auto addChild(Sexp sexp) -> void; // on a dotted list before the tail: (a . b) plus c is (a c . b)
 		auto addChild(std::string str) -> void;
 		auto addChildUnescaped(std::string str) -> void;
         auto addChildUnescaped(std::string str, int64_t startpos, int64_t endpos = 0) -> void;
@@ -40,26 +114,109 @@ namespace sexpresso {
 		auto getChild(size_t idx) -> Sexp&; // Call only if Sexp is a Sexp
         const Sexp& getChild(size_t idx) const;
 		auto getString() -> std::string&;
+		auto getTail() -> Sexp*; // the cdr of a dotted list, as in (key . value); nullptr if not dotted
+		auto getTail() const -> Sexp const*;
 		auto getChildByPath(std::string const& path) -> Sexp*; // unsafe! careful to not have the result pointer outlive the scope of the Sexp object
+		auto getChildByPath(SexpPath const& path) -> Sexp*;
 		auto createPath(std::vector<std::string> const& path) -> Sexp&;
 		auto createPath(std::string const& path) -> Sexp&;
+		auto createPath(SexpPath const& path) -> Sexp&;
+		auto enableIndex() -> void; // index filled in by the next lookup, then kept up to date by addChild
+		auto dropIndex() -> void;   // call it after editing value.sexp of an indexed node directly
+		auto index() const -> SexpIndex const*; // nullptr unless enabled
+		auto symbolKind() const -> SexpSymbolKind; // see SexpParseOptions::symbols, NONE if not classified
+		auto packageId() const -> uint32_t;
+		auto nameId() const -> uint32_t;
         auto toString(SexpressoPrintMode printmode = SexpressoPrintMode::NO_TOPLEVEL_PARENS) const -> std::string;
+        auto toString(std::string const& source, SexpressoPrintMode printmode = SexpressoPrintMode::NO_TOPLEVEL_PARENS) const -> std::string; // copies unmodified subtrees from the parsed source
+        auto toCanonical(SexpressoPrintMode printmode = SexpressoPrintMode::NO_TOPLEVEL_PARENS) const -> std::string; // Rivest csexp, drops kinds, attributes and dots
+        auto toTransport(SexpressoPrintMode printmode = SexpressoPrintMode::NO_TOPLEVEL_PARENS) const -> std::string; // base64 csexp in braces
 		auto isString() const -> bool;
 		auto isSexp() const -> bool;
 		auto isNil() const -> bool;
-		auto equal(Sexp const& other) const -> bool;
+		auto equal(Sexp const& other) const -> bool; // compares text and shape only
+		// Structural hash of kinds, attributes, text and children, not positions.
+		// Filled in by parse(), or on first use, and cached in structhash.
+		// addChild, createPath and the non-const accessors clear it on every
+		// node they pass, so ancestors see an edit made through them. After
+		// editing fields directly, or through a reference held across a hash()
+		// call, call dropHash() on a node above every edit.
+		auto hash() const -> uint64_t;
+		auto dropHash() -> void; // forgets the cached hashes of this whole subtree
+		auto strictEqual(Sexp const& other) const -> bool; // every field but positions, rejects on hash() first
+		auto operator==(Sexp const& other) const -> bool; // strictEqual
+		auto operator!=(Sexp const& other) const -> bool;
 		auto arguments() -> SexpArgumentIterator;
 		static auto unescaped(std::string strval) -> Sexp;
         static auto unescaped(std::string strval, int64_t startpos, int64_t endpos = 0) -> Sexp;
         static auto unescaped(std::string strval, SexpAtomKind atomkind, int64_t startpos, int64_t endpos = 0) -> Sexp;
 	};
 
+	struct SexpParseOptions;
+
+	// A read macro runs with pos at its macro character, or at the # before a
+	// dispatch sub-character, and moves pos past what it read. FORM adds result
+	// to the tree, NONE reads nothing (as for a comment), ERROR stops parsing
+	// with err. result's startpos and endpos are set to span the text the macro
+	// read; nodes inside it need positions of their own, as readDelimited
+	// gives them.
+	enum class SexpMacroResult : uint8_t { FORM, NONE, ERROR };
+	using SexpReadMacro = std::function<SexpMacroResult(std::string const& str, size_t& pos, Sexp& result, std::string& err)>;
+
+	// Read macros by character, looked up with one array index. Macro characters
+	// also end symbols, as terminating macro characters do in Common Lisp.
+	// Dispatch macros take over the character after #, the built in ones
+	// included. Without a readtable parse() reads standard syntax only.
+	struct SexpReadtable {
+		auto setMacroCharacter(char c, SexpReadMacro macro) -> void;
+		auto setDispatchMacroCharacter(char sub, SexpReadMacro macro) -> void;
+		std::array<SexpReadMacro, 256> macros;
+		std::array<SexpReadMacro, 256> dispatch;
+	};
+
+	// For read macros: reads forms from pos until an unmatched close character
+	// and returns them as one list, with positions in str. pos ends past close.
+	auto readDelimited(std::string const& str, size_t& pos, char close, std::string& err, SexpParseOptions const& options) -> Sexp;
+
+	// Read-time options for parse(). With featureExpressions set, #+expr form
+	// keeps form only if expr holds for features, and #-expr form only if it
+	// does not; expr is a feature name or an (:and ...), (:or ...) or (:not x)
+	// of expressions. Dropped forms are skipped by bracket matching and never
+	// built. Without it #+ and #- read as symbols, as before.
+	//
+	// With symbols set, symbols may contain |escaped parts| and \ escapes, and
+	// each one is classified as a :keyword, pkg:external, pkg::internal, #:uninterned
+	// or plain symbol, with its package and name interned into the table once.
+	// readcase folds the unescaped letters of the interned names the way
+	// Common Lisp's readtable-case does; the atom text is left as written.
+	// Tokens that start like numbers are not classified.
+	//
+	// With labels set, #n= and #n# read as symbols of their own even when a
+	// form follows without a space, for parseLabeled() in sexpresso_shared to
+	// turn into shared nodes.
+	struct SexpParseOptions {
+		bool featureExpressions = false;
+		std::unordered_set<std::string> features; // lower case, without the leading ':'
+		SexpSymbolTable* symbols = nullptr;
+		SexpReadCase readcase = SexpReadCase::PRESERVE;
+		bool labels = false;
+		SexpReadtable const* readtable = nullptr;
+	};
+
 //	auto parse(std::string const& str, std::string& err) -> Sexp;
     auto parse(std::string const& str) -> Sexp;
     auto parse(std::string const& str, std::string& err) -> Sexp;
     auto parse(std::string const& str, std::string& err, std::string& errsymbol) -> Sexp;
+    auto parse(std::string const& str, std::string& err, SexpParseOptions const& options) -> Sexp;
+    auto parse(std::string const& str, std::string& err, std::string& errsymbol, SexpParseOptions const& options) -> Sexp;
+    auto parseCanonical(std::string const& str) -> Sexp;
+    auto parseCanonical(std::string const& str, std::string& err) -> Sexp;
 	auto escape(std::string const& str) -> std::string;
 
+	namespace literals {
+		auto operator"" _path(char const* path, size_t size) -> SexpPath;
+	}
+
 	struct SexpArgumentIterator {
 		SexpArgumentIterator(Sexp& sexp);
 		Sexp& sexp;
@@ -75,4 +232,10 @@ namespace sexpresso {
 		auto empty() const -> bool;
 	};
 };
+
+namespace std {
+	template<> struct hash<sexpresso::Sexp> {
+		auto operator()(sexpresso::Sexp const& sexp) const -> size_t { return static_cast<size_t>(sexp.hash()); }
+	};
+}
 #endif
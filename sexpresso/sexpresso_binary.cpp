@@ -0,0 +1,224 @@
+// Binary encoding for sexpresso::Sexp trees
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include "sexpresso.hpp"
+#include "sexpresso_binary.hpp"
+
+namespace sexpresso {
+
+    static const char binary_magic[4] = { 'S', 'X', 'P', 'B' };
+    static const uint8_t tag_atom = 0x80;
+    static const uint8_t tag_attributes = 0x40;
+    static const uint8_t tag_dotted = 0x20;
+    static const uint8_t tag_kind_mask = 0x0f;
+
+    static auto putVarint(std::string& out, uint64_t v) -> void {
+        while(v >= 0x80) {
+            out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    static auto zigzag(int64_t v) -> uint64_t {
+        return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+    }
+
+    static auto unzigzag(uint64_t v) -> int64_t {
+        return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+    }
+
+    struct BinaryWriter {
+        std::string body;
+        std::vector<std::string const*> dictionary;
+        std::unordered_map<std::string, uint64_t> ids;
+        bool positions;
+
+        auto symbolId(std::string const& str) -> uint64_t {
+            auto found = ids.find(str);
+            if(found != ids.end()) return found->second;
+            auto id = static_cast<uint64_t>(dictionary.size());
+            auto inserted = ids.emplace(str, id);
+            dictionary.push_back(&inserted.first->first);
+            return id;
+        }
+
+        auto write(Sexp const& sexp) -> void {
+            uint8_t tag = 0;
+            if(sexp.kind == SexpValueKind::ATOM) {
+                tag = tag_atom | static_cast<uint8_t>(sexp.atomkind);
+            } else {
+                tag = static_cast<uint8_t>(sexp.sexpkind);
+                if(sexp.dotted) tag |= tag_dotted;
+            }
+            if(!sexp.attributes.empty()) tag |= tag_attributes;
+            body.push_back(static_cast<char>(tag));
+
+            if(sexp.kind == SexpValueKind::ATOM) putVarint(body, symbolId(sexp.value.str));
+            else putVarint(body, sexp.value.sexp.size());
+
+            if(!sexp.attributes.empty()) {
+                putVarint(body, sexp.attributes.size());
+                for(size_t i = 0; i < sexp.attributes.size(); i += 2) {
+                    auto packed = static_cast<uint8_t>(sexp.attributes[i]);
+                    if(i + 1 < sexp.attributes.size()) packed |= static_cast<uint8_t>(sexp.attributes[i + 1]) << 4;
+                    body.push_back(static_cast<char>(packed));
+                }
+            }
+
+            if(positions) {
+                putVarint(body, zigzag(sexp.startpos));
+                putVarint(body, zigzag(sexp.endpos - sexp.startpos));
+            }
+
+            if(sexp.kind == SexpValueKind::SEXP) {
+                for(auto const& child : sexp.value.sexp) write(child);
+            }
+        }
+    };
+
+    auto toBinary(Sexp const& sexp, SexpBinaryFlags flags) -> std::string {
+        auto writer = BinaryWriter{};
+        writer.positions = (static_cast<uint8_t>(flags) & static_cast<uint8_t>(SexpBinaryFlags::POSITIONS)) != 0;
+        writer.write(sexp);
+
+        auto out = std::string{binary_magic, sizeof(binary_magic)};
+        out.push_back(static_cast<char>(binaryFormatVersion));
+        out.push_back(static_cast<char>(flags));
+        putVarint(out, writer.dictionary.size());
+        for(auto str : writer.dictionary) {
+            putVarint(out, str->size());
+            out.append(*str);
+        }
+        out.append(writer.body);
+        return out;
+    }
+
+    struct BinaryReader {
+        uint8_t const* cur;
+        uint8_t const* end;
+        std::vector<std::string> dictionary;
+        bool positions;
+        std::string err;
+
+        auto fail(char const* msg) -> bool {
+            if(err.empty()) err = msg;
+            return false;
+        }
+
+        auto getVarint(uint64_t& v) -> bool {
+            v = 0;
+            for(unsigned shift = 0; shift < 64; shift += 7) {
+                if(cur == end) return fail("truncated varint in binary sexp");
+                auto byte = *cur++;
+                v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if((byte & 0x80) == 0) return true;
+            }
+            return fail("overlong varint in binary sexp");
+        }
+
+        auto readDictionary() -> bool {
+            uint64_t count;
+            if(!getVarint(count)) return false;
+            if(count > static_cast<uint64_t>(end - cur)) return fail("dictionary size exceeds binary sexp data");
+            dictionary.reserve(count);
+            for(uint64_t i = 0; i < count; ++i) {
+                uint64_t len;
+                if(!getVarint(len)) return false;
+                if(len > static_cast<uint64_t>(end - cur)) return fail("dictionary entry exceeds binary sexp data");
+                dictionary.emplace_back(reinterpret_cast<char const*>(cur), len);
+                cur += len;
+            }
+            return true;
+        }
+
+        auto read(Sexp& sexp) -> bool {
+            if(cur == end) return fail("truncated node in binary sexp");
+            auto tag = *cur++;
+            auto kind = tag & tag_kind_mask;
+            uint64_t length;
+            if(!getVarint(length)) return false;
+
+            if(tag & tag_atom) {
+                if(kind > static_cast<uint8_t>(SexpAtomKind::PATHNAME)) return fail("invalid atom kind in binary sexp");
+                if(length >= dictionary.size()) return fail("invalid dictionary index in binary sexp");
+                sexp.kind = SexpValueKind::ATOM;
+                sexp.atomkind = static_cast<SexpAtomKind>(kind);
+                sexp.value.str = dictionary[length];
+            } else {
+                if(kind > static_cast<uint8_t>(SexpSexpKind::COMPLEX)) return fail("invalid sexp kind in binary sexp");
+                // every child takes at least two bytes
+                if(length > static_cast<uint64_t>(end - cur) / 2) return fail("child count exceeds binary sexp data");
+                sexp.sexpkind = static_cast<SexpSexpKind>(kind);
+                sexp.dotted = (tag & tag_dotted) != 0;
+            }
+
+            if(tag & tag_attributes) {
+                uint64_t count;
+                if(!getVarint(count)) return false;
+                if((count + 1) / 2 > static_cast<uint64_t>(end - cur)) return fail("attributes exceed binary sexp data");
+                sexp.attributes.reserve(count);
+                for(uint64_t i = 0; i < count; ++i) {
+                    auto a = (i % 2 == 0) ? (*cur & 0x0f) : (*cur++ >> 4);
+                    if(a > static_cast<uint8_t>(SexpAttributeKind::DOTSPLICE)) return fail("invalid attribute kind in binary sexp");
+                    sexp.attributes.push_back(static_cast<SexpAttributeKind>(a));
+                }
+                if(count % 2 == 1) ++cur;
+            }
+
+            if(positions) {
+                uint64_t start, span;
+                if(!getVarint(start) || !getVarint(span)) return false;
+                sexp.startpos = unzigzag(start);
+                sexp.endpos = sexp.startpos + unzigzag(span);
+            }
+
+            if(!(tag & tag_atom)) {
+                sexp.value.sexp.resize(length);
+                for(auto& child : sexp.value.sexp) {
+                    if(!read(child)) return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    auto parseBinary(std::string const& data) -> Sexp {
+        auto ignored_error = std::string{};
+        return parseBinary(data, ignored_error);
+    }
+
+    auto parseBinary(std::string const& data, std::string& err) -> Sexp {
+        return parseBinary(data.data(), data.size(), err);
+    }
+
+    auto parseBinary(char const* data, size_t size, std::string& err) -> Sexp {
+        if(size < sizeof(binary_magic) + 2 || std::memcmp(data, binary_magic, sizeof(binary_magic)) != 0) {
+            err = std::string{"not a binary sexp"};
+            return Sexp{};
+        }
+        auto version = static_cast<uint8_t>(data[sizeof(binary_magic)]);
+        if(version != binaryFormatVersion) {
+            err = std::string{"unsupported binary sexp version "} + std::to_string(version);
+            return Sexp{};
+        }
+        auto reader = BinaryReader{};
+        auto flags = static_cast<uint8_t>(data[sizeof(binary_magic) + 1]);
+        reader.positions = (flags & static_cast<uint8_t>(SexpBinaryFlags::POSITIONS)) != 0;
+        reader.cur = reinterpret_cast<uint8_t const*>(data) + sizeof(binary_magic) + 2;
+        reader.end = reinterpret_cast<uint8_t const*>(data) + size;
+
+        auto sexp = Sexp{};
+        if(!reader.readDictionary() || !reader.read(sexp)) {
+            err = std::move(reader.err);
+            return Sexp{};
+        }
+        if(reader.cur != reader.end) {
+            err = std::string{"trailing data after binary sexp"};
+        }
+        return sexp;
+    }
+}
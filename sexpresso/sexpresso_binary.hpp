@@ -0,0 +1,31 @@
+#ifndef SEXPRESSO_BINARY_H
+#define SEXPRESSO_BINARY_H
+// Compact binary encoding of Sexp trees, for reloading large parse results
+// without going through the text parser again.
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    // Layout (all integers are LEB128 varints unless noted):
+    //   "SXPB" version:u8 flags:u8
+    //   dictionary: count, then count * (length, bytes)
+    //   root node
+    // Each node is tag:u8 length [attributes] [positions] children...
+    //   tag bit 7 set = ATOM, clear = SEXP; bit 6 = has attributes;
+    //   bit 5 = dotted (SEXP); bits 0-3 = atomkind (ATOM) or sexpkind (SEXP)
+    //   length = dictionary index (ATOM) or child count (SEXP)
+    //   attributes = count, then two attribute kinds packed per byte
+    //   positions = zigzag startpos, zigzag (endpos - startpos), only when
+    //   the POSITIONS flag is set in the header
+    const uint8_t binaryFormatVersion = 1;
+    enum class SexpBinaryFlags : uint8_t { NONE = 0, POSITIONS = 1 };
+
+    auto toBinary(Sexp const& sexp, SexpBinaryFlags flags = SexpBinaryFlags::POSITIONS) -> std::string;
+    auto parseBinary(std::string const& data) -> Sexp;
+    auto parseBinary(std::string const& data, std::string& err) -> Sexp;
+    auto parseBinary(char const* data, size_t size, std::string& err) -> Sexp;
+}
+#endif
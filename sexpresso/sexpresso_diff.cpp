@@ -0,0 +1,276 @@
+// Structural diff and patch of sexpresso::Sexp trees
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <algorithm>
+#include "sexpresso.hpp"
+#include "sexpresso_diff.hpp"
+
+namespace sexpresso {
+
+    auto SexpPatch::empty() const -> bool {
+        return this->edits.empty();
+    }
+
+    // The cached hashes stand for the content, so matching a subtree costs
+    // two loads however big it is.
+    static auto sameContent(Sexp const& a, Sexp const& b) -> bool {
+        return a.hash() == b.hash();
+    }
+
+    // Everything but the children: lists that agree here can be diffed
+    // child by child, anything else is replaced.
+    static auto sameHeader(Sexp const& a, Sexp const& b) -> bool {
+        if(a.kind != b.kind || a.sexpkind != b.sexpkind || a.atomkind != b.atomkind || a.dotted != b.dotted || a.attributes != b.attributes) return false;
+        return a.kind == SexpValueKind::SEXP || a.value.str == b.value.str;
+    }
+
+    // Children of different lists are paired up for a recursive diff when
+    // they are lists with the same head atom, or both atoms.
+    static auto pairLabel(Sexp const& sexp) -> std::string {
+        if(sexp.kind == SexpValueKind::ATOM) return std::string{"a"};
+        if(!sexp.value.sexp.empty() && sexp.value.sexp[0].kind == SexpValueKind::ATOM) return "l" + sexp.value.sexp[0].value.str;
+        return std::string{"l"};
+    }
+
+    static auto childPath(std::vector<size_t> const& path, size_t idx) -> std::vector<size_t> {
+        auto result = path;
+        result.push_back(idx);
+        return result;
+    }
+
+    // Positions in seq that form a longest increasing subsequence
+    static auto longestIncreasing(std::vector<size_t> const& seq) -> std::vector<bool> {
+        auto tails = std::vector<size_t>{}; // index into seq of the smallest tail of each length
+        auto prev = std::vector<size_t>(seq.size(), SIZE_MAX);
+        for(size_t i = 0; i < seq.size(); ++i) {
+            auto pos = std::lower_bound(tails.begin(), tails.end(), seq[i], [&seq](size_t t, size_t v) { return seq[t] < v; }) - tails.begin();
+            if(pos > 0) prev[i] = tails[pos - 1];
+            if(static_cast<size_t>(pos) == tails.size()) tails.push_back(i);
+            else tails[pos] = i;
+        }
+        auto keep = std::vector<bool>(seq.size(), false);
+        for(auto i = tails.empty() ? SIZE_MAX : tails.back(); i != SIZE_MAX; i = prev[i]) keep[i] = true;
+        return keep;
+    }
+
+    namespace {
+        // Counts of ranks in use, for positions in a list that changes as
+        // children are moved through it.
+        struct Fenwick {
+            explicit Fenwick(size_t size) : tree(size + 1, 0) {}
+            auto add(size_t rank, int delta) -> void {
+                for(auto i = rank + 1; i < this->tree.size(); i += i & (~i + 1)) this->tree[i] += delta;
+            }
+            auto before(size_t rank) const -> size_t { // ranks in use below rank
+                long sum = 0;
+                for(auto i = rank; i > 0; i -= i & (~i + 1)) sum += this->tree[i];
+                return static_cast<size_t>(sum);
+            }
+            std::vector<long> tree;
+        };
+    }
+
+    static auto diffNode(Sexp const& a, Sexp const& b, std::vector<size_t> const& path, SexpPatch& patch) -> void;
+
+    static auto diffChildren(Sexp const& a, Sexp const& b, std::vector<size_t> const& path, SexpPatch& patch) -> void {
+        auto& as = a.value.sexp;
+        auto& bs = b.value.sexp;
+        size_t prefix = 0;
+        while(prefix < as.size() && prefix < bs.size() && sameContent(as[prefix], bs[prefix])) ++prefix;
+        size_t suffix = 0;
+        while(suffix < as.size() - prefix && suffix < bs.size() - prefix
+              && sameContent(as[as.size() - 1 - suffix], bs[bs.size() - 1 - suffix])) ++suffix;
+        auto na = as.size() - prefix - suffix;
+        auto nb = bs.size() - prefix - suffix;
+        if(na == 0 && nb == 0) return;
+
+        // match identical children by hash, then pair up the rest
+        auto source = std::vector<size_t>(nb, SIZE_MAX); // a child each b child comes from
+        auto paired = std::vector<bool>(nb, false);      // source differs and needs its own diff
+        auto used = std::vector<bool>(na, false);
+        auto byhash = std::unordered_map<uint64_t, std::vector<size_t>>{};
+        for(size_t i = na; i-- > 0;) byhash[as[prefix + i].hash()].push_back(i);
+        for(size_t j = 0; j < nb; ++j) {
+            auto found = byhash.find(bs[prefix + j].hash());
+            if(found == byhash.end()) continue;
+            auto& candidates = found->second;
+            if(candidates.empty()) continue;
+            source[j] = candidates.back();
+            used[source[j]] = true;
+            candidates.pop_back();
+        }
+        auto bylabel = std::unordered_map<std::string, std::vector<size_t>>{};
+        for(size_t i = na; i-- > 0;) {
+            if(!used[i]) bylabel[pairLabel(as[prefix + i])].push_back(i);
+        }
+        for(size_t j = 0; j < nb; ++j) {
+            if(source[j] != SIZE_MAX) continue;
+            auto found = bylabel.find(pairLabel(bs[prefix + j]));
+            if(found == bylabel.end() || found->second.empty()) continue;
+            source[j] = found->second.back();
+            found->second.pop_back();
+            used[source[j]] = true;
+            paired[j] = true;
+        }
+
+        // delete what is not used, last first so earlier indices stay put
+        for(size_t i = na; i-- > 0;) {
+            if(used[i]) continue;
+            patch.edits.push_back(SexpEdit{SexpEditKind::DELETE, childPath(path, prefix + i), 0, Sexp{}});
+        }
+
+        // children on a longest run that is already in order stay where they
+        // are; every other child is moved or inserted right after the child
+        // that precedes it in b, which keeps the placed ones in b's order
+        auto order = std::vector<size_t>{};
+        auto orderpos = std::vector<size_t>{};
+        for(size_t j = 0; j < nb; ++j) {
+            if(source[j] == SIZE_MAX) continue;
+            order.push_back(source[j]);
+            orderpos.push_back(j);
+        }
+        auto stays = std::vector<bool>(nb, false);
+        auto keep = longestIncreasing(order);
+        for(size_t k = 0; k < order.size(); ++k) stays[orderpos[k]] = keep[k];
+
+        // Replay the placements on counts instead of on a list: every child
+        // gets a rank that sorts like its place in the working list. Children
+        // of a that have not moved yet keep their order from a, and the run of
+        // children placed one after another follows the child that stays
+        // before them in b, or goes first. A Fenwick tree of the ranks in use
+        // turns each position into a prefix count.
+        auto slot = std::vector<size_t>(na, SIZE_MAX); // place in the working list as it starts
+        size_t nw = 0;
+        for(size_t i = 0; i < na; ++i) {
+            if(used[i]) slot[i] = nw++;
+        }
+        auto group = std::vector<size_t>(nb, 0);  // slot + 1 of the child staying before, 0 if none
+        auto runs = std::vector<size_t>(nw + 1, 0);
+        size_t cur = 0;
+        for(size_t j = 0; j < nb; ++j) {
+            if(stays[j]) cur = slot[source[j]] + 1;
+            else ++runs[group[j] = cur];
+        }
+        auto first = std::vector<size_t>(nw + 2, 0); // rank of each group's staying child, then its run
+        for(size_t g = 0; g <= nw; ++g) first[g + 1] = first[g] + (g > 0 ? 1 : 0) + runs[g];
+        auto present = Fenwick{first[nw + 1]};
+        for(size_t w = 0; w < nw; ++w) present.add(first[w + 1], 1);
+
+        auto placed = std::vector<size_t>(nw + 1, 0);
+        for(size_t j = 0; j < nb; ++j) {
+            if(stays[j]) continue;
+            auto g = group[j];
+            auto rank = first[g] + (g > 0 ? 1 : 0) + placed[g]++;
+            if(source[j] == SIZE_MAX) {
+                auto at = present.before(rank);
+                present.add(rank, 1);
+                patch.edits.push_back(SexpEdit{SexpEditKind::INSERT, childPath(path, prefix + at), 0, bs[prefix + j]});
+                continue;
+            }
+            auto old = first[slot[source[j]] + 1];
+            auto from = present.before(old);
+            present.add(old, -1);
+            auto at = present.before(rank);
+            present.add(rank, 1);
+            if(from != at) patch.edits.push_back(SexpEdit{SexpEditKind::MOVE, childPath(path, prefix + from), prefix + at, Sexp{}});
+        }
+
+        for(size_t j = 0; j < nb; ++j) {
+            if(paired[j]) diffNode(as[prefix + source[j]], bs[prefix + j], childPath(path, prefix + j), patch);
+        }
+    }
+
+    static auto diffNode(Sexp const& a, Sexp const& b, std::vector<size_t> const& path, SexpPatch& patch) -> void {
+        if(sameContent(a, b)) return;
+        if(!sameHeader(a, b)) {
+            patch.edits.push_back(SexpEdit{SexpEditKind::REPLACE, path, 0, b});
+            return;
+        }
+        diffChildren(a, b, path, patch);
+    }
+
+    auto diff(Sexp const& from, Sexp const& to) -> SexpPatch {
+        auto patch = SexpPatch{};
+        diffNode(from, to, std::vector<size_t>{}, patch);
+        return patch;
+    }
+
+    // Follows path to the list holding its last index, marking every node on
+    // the way as changed.
+    static auto editParent(Sexp& tree, std::vector<size_t> const& path, std::string& err) -> Sexp* {
+        auto cur = &tree;
+        for(size_t i = 0; i + 1 < path.size(); ++i) {
+            cur->dirty = true;
+            cur->structhash.clear();
+            if(cur->kind != SexpValueKind::SEXP || path[i] >= cur->value.sexp.size()) {
+                err = std::string{"patch path does not fit the tree"};
+                return nullptr;
+            }
+            cur = &cur->value.sexp[path[i]];
+        }
+        if(cur->kind != SexpValueKind::SEXP) {
+            err = std::string{"patch path does not fit the tree"};
+            return nullptr;
+        }
+        cur->dirty = true;
+        cur->structhash.clear();
+        cur->dropIndex();
+        return cur;
+    }
+
+    // Nodes from a patch were read from another source, so their positions
+    // would make toString(source) copy unrelated text.
+    static auto withoutPositions(Sexp node) -> Sexp {
+        auto stack = std::vector<Sexp*>{&node};
+        while(!stack.empty()) {
+            auto cur = stack.back();
+            stack.pop_back();
+            cur->startpos = 0;
+            cur->endpos = 0;
+            for(auto& child : cur->value.sexp) stack.push_back(&child);
+        }
+        return node;
+    }
+
+    auto apply(Sexp& tree, SexpPatch const& patch, std::string& err) -> bool {
+        for(auto const& edit : patch.edits) {
+            if(edit.path.empty()) {
+                if(edit.kind != SexpEditKind::REPLACE) {
+                    err = std::string{"only REPLACE can apply to the root"};
+                    return false;
+                }
+                tree = withoutPositions(edit.node);
+                continue;
+            }
+            auto parent = editParent(tree, edit.path, err);
+            if(parent == nullptr) return false;
+            auto& children = parent->value.sexp;
+            auto idx = edit.path.back();
+            auto limit = edit.kind == SexpEditKind::INSERT ? children.size() + 1 : children.size();
+            if(idx >= limit || (edit.kind == SexpEditKind::MOVE && edit.to >= children.size())) {
+                err = std::string{"patch index out of range"};
+                return false;
+            }
+            switch(edit.kind) {
+                case SexpEditKind::INSERT:
+                    children.insert(children.begin() + static_cast<std::ptrdiff_t>(idx), withoutPositions(edit.node));
+                    break;
+                case SexpEditKind::DELETE:
+                    children.erase(children.begin() + static_cast<std::ptrdiff_t>(idx));
+                    break;
+                case SexpEditKind::REPLACE:
+                    children[idx] = withoutPositions(edit.node);
+                    break;
+                case SexpEditKind::MOVE: {
+                    auto node = std::move(children[idx]);
+                    children.erase(children.begin() + static_cast<std::ptrdiff_t>(idx));
+                    children.insert(children.begin() + static_cast<std::ptrdiff_t>(edit.to), std::move(node));
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef SEXPRESSO_DIFF_H
+#define SEXPRESSO_DIFF_H
+// Structural diff and patch of Sexp trees.
+//
+//   auto patch = sexpresso::diff(before, after);
+//   sexpresso::apply(before, patch, err); // before is now strictEqual to after
+//
+// Edits address nodes by child indices from the root and are applied in
+// order, each against the tree as the edits before it left it. Children are
+// matched through the hashes cached on the nodes, so unchanged subtrees cost
+// one comparison and are never descended into; subtrees with equal 64-bit
+// hashes are taken to be equal. Children that only changed place become
+// MOVEs, changed lists with the same head are diffed recursively, and what
+// is left is inserted, deleted or replaced.
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    enum class SexpEditKind : uint8_t { INSERT, DELETE, REPLACE, MOVE };
+
+    struct SexpEdit {
+        SexpEditKind kind;
+        std::vector<size_t> path; // INSERT: where the node goes, MOVE: where it is taken from
+        size_t to;                // MOVE: index in the same list once the node is taken out
+        Sexp node;                // INSERT, REPLACE
+    };
+
+    struct SexpPatch {
+        std::vector<SexpEdit> edits;
+        auto empty() const -> bool;
+    };
+
+    auto diff(Sexp const& from, Sexp const& to) -> SexpPatch;
+    auto apply(Sexp& tree, SexpPatch const& patch, std::string& err) -> bool; // stops at the first edit that does not fit
+}
+#endif
@@ -0,0 +1,269 @@
+// Persistent on-disk cache of parsed sexpresso::Sexp trees
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <thread>
+#include "sexpresso.hpp"
+#include "sexpresso_binary.hpp"
+#include "sexpresso_diskcache.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SEXPRESSO_DISKCACHE_POSIX
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+namespace sexpresso {
+
+    // Layout: "SXPC" version:u8 size:u64 mtime:u64 contenthash:u64
+    // pathlength:u32 path, then a sexpresso_binary image to the end of the
+    // file. Integers are little endian.
+    static const char entryMagic[4] = { 'S', 'X', 'P', 'C' };
+    static const uint8_t entryVersion = 1;
+    static const size_t entryFixedSize = 4 + 1 + 8 + 8 + 8 + 4;
+    static const char entrySuffix[] = ".sxpc";
+
+    namespace {
+        struct SourceInfo {
+            uint64_t size = 0;
+            int64_t mtime = 0; // nanoseconds, 0 when unknown
+        };
+
+        struct EntryHeader {
+            uint64_t size = 0;
+            int64_t mtime = 0;
+            uint64_t contenthash = 0;
+            std::string path;
+            size_t length = 0; // bytes before the image
+        };
+    }
+
+    static auto putUint(std::string& out, uint64_t value, size_t bytes) -> void {
+        for(size_t i = 0; i < bytes; ++i) out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+
+    static auto getUint(char const* data, size_t bytes) -> uint64_t {
+        uint64_t value = 0;
+        for(size_t i = 0; i < bytes; ++i) value |= static_cast<uint64_t>(static_cast<uint8_t>(data[i])) << (8 * i);
+        return value;
+    }
+
+    static auto statSource(std::string const& path, SourceInfo& info) -> bool {
+#ifdef SEXPRESSO_DISKCACHE_POSIX
+        struct stat st;
+        if(::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) return false;
+        info.size = static_cast<uint64_t>(st.st_size);
+#if defined(__APPLE__)
+        info.mtime = static_cast<int64_t>(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+        info.mtime = static_cast<int64_t>(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+        return true;
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if(!file) return false;
+        info.size = static_cast<uint64_t>(file.tellg());
+        info.mtime = 0;
+        return true;
+#endif
+    }
+
+    static auto readFile(std::string const& path, std::string& contents) -> bool {
+        std::ifstream file(path, std::ios::binary);
+        if(!file) return false;
+        file.seekg(0, std::ios::end);
+        auto size = file.tellg();
+        if(size < 0) return false;
+        contents.resize(static_cast<size_t>(size));
+        file.seekg(0, std::ios::beg);
+        file.read(&contents[0], static_cast<std::streamsize>(contents.size()));
+        return static_cast<bool>(file) || contents.empty();
+    }
+
+    static auto parseHeader(std::string const& data, EntryHeader& header) -> bool {
+        if(data.size() < entryFixedSize || std::memcmp(data.data(), entryMagic, 4) != 0) return false;
+        if(static_cast<uint8_t>(data[4]) != entryVersion) return false;
+        auto p = data.data() + 5;
+        header.size = getUint(p, 8);
+        header.mtime = static_cast<int64_t>(getUint(p + 8, 8));
+        header.contenthash = getUint(p + 16, 8);
+        auto pathlength = static_cast<size_t>(getUint(p + 24, 4));
+        if(data.size() - entryFixedSize < pathlength) return false;
+        header.path.assign(data.data() + entryFixedSize, pathlength);
+        header.length = entryFixedSize + pathlength;
+        return true;
+    }
+
+    // Reads no more of the entry than its header, for prune()
+    static auto readHeader(std::string const& entry, EntryHeader& header) -> bool {
+        std::ifstream file(entry, std::ios::binary | std::ios::ate);
+        if(!file) return false;
+        auto size = file.tellg();
+        if(size < static_cast<std::streamoff>(entryFixedSize)) return false;
+        file.seekg(0, std::ios::beg);
+        auto data = std::string(entryFixedSize, '\0');
+        if(!file.read(&data[0], static_cast<std::streamsize>(entryFixedSize))) return false;
+        auto pathlength = static_cast<size_t>(getUint(data.data() + entryFixedSize - 4, 4));
+        if(pathlength > static_cast<uint64_t>(size) - entryFixedSize) return false;
+        data.resize(entryFixedSize + pathlength);
+        if(pathlength != 0 && !file.read(&data[entryFixedSize], static_cast<std::streamsize>(pathlength))) return false;
+        return parseHeader(data, header);
+    }
+
+    // Is the entry still a parse of the source as it is now? contents is
+    // filled in when the source had to be read to tell.
+    static auto entryFresh(EntryHeader const& header, SourceInfo const& source, SexpCacheValidation validation, std::string const& path, std::string& contents, bool& read) -> bool {
+        if(header.path != path || header.size != source.size) return false;
+        if(validation == SexpCacheValidation::MTIME && source.mtime != 0) return header.mtime == source.mtime;
+        read = readFile(path, contents);
+        return read && hashString(contents.data(), contents.size()) == header.contenthash;
+    }
+
+    static auto writeEntry(std::string const& entry, std::string const& data) -> bool {
+        auto tmp = entry + "." + std::to_string(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+#ifdef SEXPRESSO_DISKCACHE_POSIX
+        tmp += "." + std::to_string(::getpid());
+#endif
+        tmp += ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            if(!out) return false;
+            out.write(data.data(), static_cast<std::streamsize>(data.size()));
+            if(!out) {
+                out.close();
+                std::remove(tmp.c_str());
+                return false;
+            }
+        }
+#ifndef SEXPRESSO_DISKCACHE_POSIX
+        std::remove(entry.c_str()); // rename does not replace on Windows
+#endif
+        if(std::rename(tmp.c_str(), entry.c_str()) != 0) {
+            std::remove(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    SexpDiskCache::SexpDiskCache(std::string directory, SexpCacheValidation validation, uint64_t maxbytes)
+        : directory(std::move(directory)), validation(validation), maxbytes(maxbytes) {
+#ifndef SEXPRESSO_DISKCACHE_POSIX
+        this->validation = SexpCacheValidation::CONTENT;
+#endif
+    }
+
+    auto SexpDiskCache::entryPath(std::string const& path) const -> std::string {
+        char name[17];
+        std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(hashString(path.data(), path.size())));
+        auto entry = this->directory;
+        if(!entry.empty() && entry.back() != '/' && entry.back() != '\\') entry.push_back('/');
+        return entry + name + entrySuffix;
+    }
+
+    auto SexpDiskCache::parseFile(std::string const& path, std::string& err) -> Sexp {
+        auto source = SourceInfo{};
+        if(!statSource(path, source)) {
+            err = std::string{"could not read "} + path;
+            return Sexp{};
+        }
+        auto entry = this->entryPath(path);
+        auto data = std::string{};
+        auto header = EntryHeader{};
+        auto contents = std::string{};
+        auto read = false;
+        if(readFile(entry, data) && parseHeader(data, header) && entryFresh(header, source, this->validation, path, contents, read)) {
+            auto imageerr = std::string{};
+            auto sexp = parseBinary(data.data() + header.length, data.size() - header.length, imageerr);
+            if(imageerr.empty()) {
+                ++this->hits;
+#ifdef SEXPRESSO_DISKCACHE_POSIX
+                ::utime(entry.c_str(), nullptr); // recency for prune()
+#endif
+                return sexp;
+            }
+        }
+        ++this->misses;
+        if(!read && !readFile(path, contents)) {
+            err = std::string{"could not read "} + path;
+            return Sexp{};
+        }
+        auto sexp = parse(contents, err);
+        if(!err.empty()) return sexp;
+
+        // The size and time are from before the read, so an edit racing with
+        // it leaves an entry that fails validation next time.
+        data.clear();
+        data.append(entryMagic, 4);
+        data.push_back(static_cast<char>(entryVersion));
+        putUint(data, source.size, 8);
+        putUint(data, static_cast<uint64_t>(source.mtime), 8);
+        putUint(data, hashString(contents.data(), contents.size()), 8);
+        putUint(data, path.size(), 4);
+        data += path;
+        data += toBinary(sexp);
+        if(writeEntry(entry, data)) ++this->writes;
+        return sexp;
+    }
+
+    auto SexpDiskCache::invalidate(std::string const& path) -> void {
+        std::remove(this->entryPath(path).c_str());
+    }
+
+    auto SexpDiskCache::prune() -> size_t {
+        size_t removed = 0;
+#ifdef SEXPRESSO_DISKCACHE_POSIX
+        struct Kept {
+            std::string entry;
+            uint64_t bytes;
+            int64_t used;
+        };
+        auto kept = std::vector<Kept>{};
+        auto dir = ::opendir(this->directory.empty() ? "." : this->directory.c_str());
+        if(dir == nullptr) return 0;
+        auto suffixlength = std::strlen(entrySuffix);
+        auto names = std::vector<std::string>{};
+        while(auto item = ::readdir(dir)) {
+            auto name = std::string{item->d_name};
+            if(name.size() == 16 + suffixlength && name.compare(16, suffixlength, entrySuffix) == 0) names.push_back(name);
+        }
+        ::closedir(dir);
+
+        auto prefix = this->entryPath("");
+        prefix.resize(prefix.size() - 16 - suffixlength);
+        for(auto& name : names) {
+            auto entry = prefix + name;
+            auto header = EntryHeader{};
+            auto source = SourceInfo{};
+            auto contents = std::string{};
+            auto read = false;
+            struct stat st;
+            if(::stat(entry.c_str(), &st) != 0) continue;
+            if(!readHeader(entry, header) || !statSource(header.path, source)
+                    || !entryFresh(header, source, this->validation, header.path, contents, read)) {
+                if(std::remove(entry.c_str()) == 0) ++removed;
+                continue;
+            }
+            kept.push_back(Kept{entry, static_cast<uint64_t>(st.st_size), static_cast<int64_t>(st.st_mtime)});
+        }
+
+        if(this->maxbytes == 0) return removed;
+        uint64_t total = 0;
+        for(auto& k : kept) total += k.bytes;
+        std::sort(kept.begin(), kept.end(), [](Kept const& a, Kept const& b) { return a.used < b.used; });
+        for(auto& k : kept) {
+            if(total <= this->maxbytes) break;
+            if(std::remove(k.entry.c_str()) == 0) ++removed;
+            total -= k.bytes;
+        }
+#endif
+        return removed;
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef SEXPRESSO_DISKCACHE_H
+#define SEXPRESSO_DISKCACHE_H
+// Persistent cache of parse results, so files that did not change since the
+// last run are loaded from a binary image instead of being parsed again.
+//
+//   sexpresso::SexpDiskCache cache{".sexpcache"};
+//   auto err = std::string{};
+//   auto sexp = cache.parseFile("board.kicad_pcb", err);
+//   ...
+//   cache.prune(); // drop entries of changed or deleted files
+//
+// Each source path has one entry, named after hashString() of the path and
+// holding the source size, modification time and content hash followed by
+// the tree in the sexpresso_binary format. With MTIME validation a warm hit
+// costs a stat of the source and a read of the entry; CONTENT validation
+// also reads and hashes the source, which catches edits that keep the size
+// and the timestamp. A stale entry is overwritten by the next parse of its
+// file. Files that fail to parse are never cached, so their errors are
+// reported every time. Entries are written to a temporary file and renamed
+// into place, so several processes can share a directory.
+//
+// Modification times, pruning and the size limit need POSIX; elsewhere
+// entries are always validated by content and prune() does nothing.
+
+#include <string>
+#include <cstdint>
+#include <atomic>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    enum class SexpCacheValidation : uint8_t { MTIME, CONTENT };
+
+    struct SexpDiskCache {
+        // The directory must exist. maxbytes caps the total size of the entries
+        // prune() keeps, least recently used go first; 0 for no limit.
+        explicit SexpDiskCache(std::string directory, SexpCacheValidation validation = SexpCacheValidation::MTIME, uint64_t maxbytes = 0);
+
+        auto parseFile(std::string const& path, std::string& err) -> Sexp; // errors as parse(), or "could not read <path>"
+        auto invalidate(std::string const& path) -> void;
+        auto prune() -> size_t; // entries removed
+        auto entryPath(std::string const& path) const -> std::string;
+
+        std::string directory;
+        SexpCacheValidation validation;
+        uint64_t maxbytes;
+        std::atomic<size_t> hits{0};
+        std::atomic<size_t> misses{0};  // includes stale entries
+        std::atomic<size_t> writes{0};
+    };
+}
+#endif
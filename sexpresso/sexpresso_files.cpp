@@ -0,0 +1,151 @@
+// Parallel parsing of many files
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <future>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include "sexpresso.hpp"
+#include "sexpresso_files.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SEXPRESSO_FILES_STAT
+#include <sys/stat.h>
+#endif
+
+namespace sexpresso {
+
+    namespace {
+        struct ReadFile {
+            size_t index;
+            std::string contents;
+            std::string err;
+        };
+
+        struct BatchState {
+            std::vector<std::string> paths;
+            SexpFileOptions options;
+            std::vector<std::promise<SexpFileResult>> promises;
+            std::vector<size_t> order;
+            std::atomic<size_t> nextread{0};
+
+            std::mutex mutex;
+            std::condition_variable notfull;
+            std::condition_variable notempty;
+            std::deque<ReadFile> queue;
+            size_t readersleft = 0;
+        };
+    }
+
+    static auto fileSize(std::string const& path) -> uint64_t {
+#ifdef SEXPRESSO_FILES_STAT
+        struct stat st;
+        if(::stat(path.c_str(), &st) != 0) return 0;
+        return static_cast<uint64_t>(st.st_size);
+#else
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if(!file) return 0;
+        return static_cast<uint64_t>(file.tellg());
+#endif
+    }
+
+    static auto readFile(std::string const& path, std::string& contents) -> bool {
+        std::ifstream file(path, std::ios::binary);
+        if(!file) return false;
+        file.seekg(0, std::ios::end);
+        auto size = file.tellg();
+        if(size < 0) return false;
+        contents.resize(static_cast<size_t>(size));
+        file.seekg(0, std::ios::beg);
+        file.read(&contents[0], static_cast<std::streamsize>(contents.size()));
+        return static_cast<bool>(file) || contents.empty();
+    }
+
+    static auto readerLoop(BatchState& state, size_t capacity) -> void {
+        while(true) {
+            auto next = state.nextread++;
+            if(next >= state.order.size()) break;
+            auto item = ReadFile{state.order[next], std::string{}, std::string{}};
+            if(!readFile(state.paths[item.index], item.contents)) item.err = std::string{"could not read "} + state.paths[item.index];
+            std::unique_lock<std::mutex> lock(state.mutex);
+            state.notfull.wait(lock, [&state, capacity]() { return state.queue.size() < capacity; });
+            state.queue.push_back(std::move(item));
+            state.notempty.notify_one();
+        }
+        std::lock_guard<std::mutex> lock(state.mutex);
+        --state.readersleft;
+        state.notempty.notify_all();
+    }
+
+    static auto parserLoop(BatchState& state) -> void {
+        while(true) {
+            auto item = ReadFile{};
+            {
+                std::unique_lock<std::mutex> lock(state.mutex);
+                state.notempty.wait(lock, [&state]() { return !state.queue.empty() || state.readersleft == 0; });
+                if(state.queue.empty()) return;
+                item = std::move(state.queue.front());
+                state.queue.pop_front();
+                state.notfull.notify_one();
+            }
+            auto result = SexpFileResult{};
+            result.path = state.paths[item.index];
+            result.err = std::move(item.err);
+            if(result.err.empty()) result.sexp = parse(item.contents, result.err);
+            if(state.options.keepSource) result.source = std::move(item.contents);
+            auto& promise = state.promises[item.index];
+            try {
+                if(state.options.onFile) state.options.onFile(result);
+                promise.set_value(std::move(result));
+            } catch(...) {
+                promise.set_exception(std::current_exception());
+            }
+        }
+    }
+
+    static auto runBatch(std::shared_ptr<BatchState> state) -> void {
+        auto& options = state->options;
+        state->order.resize(state->paths.size());
+        for(size_t i = 0; i < state->order.size(); ++i) state->order[i] = i;
+        if(options.largestFirst) {
+            auto sizes = std::vector<uint64_t>(state->paths.size());
+            for(size_t i = 0; i < sizes.size(); ++i) sizes[i] = fileSize(state->paths[i]);
+            std::stable_sort(state->order.begin(), state->order.end(), [&sizes](size_t a, size_t b) { return sizes[a] > sizes[b]; });
+        }
+
+        auto parsers = options.threads != 0 ? options.threads : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        auto readers = std::max<size_t>(options.readers, 1);
+        auto capacity = options.queued != 0 ? options.queued : parsers * 2;
+        state->readersleft = readers;
+        auto threads = std::vector<std::thread>{};
+        for(size_t i = 0; i < readers; ++i) threads.emplace_back([state, capacity]() { readerLoop(*state, capacity); });
+        for(size_t i = 0; i < parsers; ++i) threads.emplace_back([state]() { parserLoop(*state); });
+        for(auto& thread : threads) thread.join();
+    }
+
+    SexpFileBatch::~SexpFileBatch() {
+        this->wait();
+    }
+
+    auto SexpFileBatch::wait() -> void {
+        if(this->coordinator.joinable()) this->coordinator.join();
+    }
+
+    auto parseFilesAsync(std::vector<std::string> const& paths, SexpFileOptions const& options) -> SexpFileBatch {
+        auto state = std::make_shared<BatchState>();
+        state->paths = paths;
+        state->options = options;
+        state->promises.resize(paths.size());
+        auto batch = SexpFileBatch{};
+        for(auto& promise : state->promises) batch.results.push_back(promise.get_future());
+        batch.coordinator = std::thread{[state]() { runBatch(state); }};
+        return batch;
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef SEXPRESSO_FILES_H
+#define SEXPRESSO_FILES_H
+// Parses many files at once.
+//
+//   auto batch = sexpresso::parseFilesAsync(paths);
+//   for(auto& result : batch.results) {
+//       auto file = result.get();
+//       if(!file.err.empty()) ...
+//   }
+//
+// A few reader threads load files, largest first so the longest parses start
+// early, into a bounded queue that a pool of parser threads drains, so
+// reading overlaps with parsing and memory stays bounded. Each file's future
+// is ready as soon as that file is done; options.onFile is called on the
+// parser thread just before.
+
+#include <vector>
+#include <string>
+#include <future>
+#include <thread>
+#include <functional>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    struct SexpFileResult {
+        std::string path;
+        Sexp sexp;
+        std::string err; // empty on success
+        std::string source; // only with options.keepSource, for Sexp::toString(source)
+    };
+
+    struct SexpFileOptions {
+        size_t threads = 0; // parser threads, 0 for std::thread::hardware_concurrency()
+        size_t readers = 2;
+        size_t queued = 0;  // files read but not yet parsed, 0 for twice the parser threads
+        bool largestFirst = true;
+        bool keepSource = false;
+        std::function<void(SexpFileResult const&)> onFile;
+    };
+
+    struct SexpFileBatch {
+        SexpFileBatch() = default;
+        SexpFileBatch(SexpFileBatch&&) = default;
+        SexpFileBatch& operator=(SexpFileBatch&&) = delete;
+        ~SexpFileBatch(); // waits for the batch to finish
+
+        auto wait() -> void;
+
+        std::vector<std::future<SexpFileResult>> results; // in the order of the paths
+        std::thread coordinator;
+    };
+
+    auto parseFilesAsync(std::vector<std::string> const& paths, SexpFileOptions const& options = SexpFileOptions{}) -> SexpFileBatch;
+}
+#endif
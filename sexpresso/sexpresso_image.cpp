@@ -0,0 +1,355 @@
+// Flat tree images for sexpresso::Sexp, queried in place through SexpView
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include "sexpresso.hpp"
+#include "sexpresso_image.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define SEXPRESSO_IMAGE_MMAP
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace sexpresso {
+
+    static const char image_magic[4] = { 'S', 'X', 'P', 'I' };
+    static const size_t image_header_size = 32;
+
+    static_assert(sizeof(SexpImageNode) == 40, "SexpImageNode must stay 40 bytes, it is written to disk as is");
+
+    auto SexpStringRef::str() const -> std::string {
+        return std::string{this->data, this->size};
+    }
+
+    auto SexpStringRef::operator==(std::string const& other) const -> bool {
+        return other.size() == this->size && std::memcmp(other.data(), this->data, this->size) == 0;
+    }
+
+    auto SexpStringRef::operator!=(std::string const& other) const -> bool {
+        return !(*this == other);
+    }
+
+    auto toImage(Sexp const& sexp) -> std::string {
+        auto ignored_error = std::string{};
+        return toImage(sexp, ignored_error);
+    }
+
+    auto toImage(Sexp const& sexp, std::string& err) -> std::string {
+        auto nodes = std::vector<SexpImageNode>{};
+        auto attribs = std::string{};
+        auto strings = std::string{};
+        // breadth first, so that each list's children end up next to each other
+        auto order = std::vector<Sexp const*>{&sexp};
+        for(size_t i = 0; i < order.size(); ++i) {
+            auto& cur = *order[i];
+            auto node = SexpImageNode{};
+            node.kind = static_cast<uint8_t>(cur.kind);
+            if(cur.attributes.size() > UINT16_MAX || attribs.size() > UINT32_MAX) {
+                err = std::string{"too many attributes for a sexp image"};
+                return std::string{};
+            }
+            node.attribcount = static_cast<uint16_t>(cur.attributes.size());
+            node.attriboffset = static_cast<uint32_t>(attribs.size());
+            for(auto a : cur.attributes) attribs.push_back(static_cast<char>(a));
+            node.startpos = cur.startpos;
+            node.endpos = cur.endpos;
+            switch(cur.kind) {
+                case SexpValueKind::ATOM:
+                    node.subkind = static_cast<uint8_t>(cur.atomkind);
+                    node.first = strings.size();
+                    node.count = cur.value.str.size();
+                    strings.append(cur.value.str);
+                    break;
+                case SexpValueKind::SEXP:
+                    node.subkind = static_cast<uint8_t>(cur.sexpkind) | (cur.dotted ? imageDotted : 0);
+                    node.first = order.size();
+                    node.count = cur.value.sexp.size();
+                    for(auto const& child : cur.value.sexp) order.push_back(&child);
+                    break;
+            }
+            nodes.push_back(node);
+        }
+        // pad so the string table starts on an 8 byte boundary too
+        while(attribs.size() % 8 != 0) attribs.push_back('\0');
+
+        auto out = std::string{image_magic, sizeof(image_magic)};
+        auto put = [&out](void const* p, size_t n) { out.append(static_cast<char const*>(p), n); };
+        uint64_t nodecount = nodes.size();
+        uint64_t attribbytes = attribs.size();
+        uint64_t stringbytes = strings.size();
+        put(&imageFormatVersion, sizeof(imageFormatVersion));
+        put(&imageByteOrderMark, sizeof(imageByteOrderMark));
+        put(&nodecount, sizeof(nodecount));
+        put(&attribbytes, sizeof(attribbytes));
+        put(&stringbytes, sizeof(stringbytes));
+        put(nodes.data(), nodes.size() * sizeof(SexpImageNode));
+        out.append(attribs);
+        out.append(strings);
+        return out;
+    }
+
+    SexpImage::SexpImage() :
+        data(nullptr), size(0), nodes(nullptr), attribs(nullptr), strings(nullptr),
+        nodecount(0), attribbytes(0), stringbytes(0), mapping(nullptr), mappingsize(0) {}
+
+    SexpImage::~SexpImage() {
+        this->release();
+    }
+
+    auto SexpImage::release() -> void {
+#ifdef SEXPRESSO_IMAGE_MMAP
+        if(this->mapping != nullptr) munmap(this->mapping, this->mappingsize);
+#endif
+        this->mapping = nullptr;
+        this->mappingsize = 0;
+        std::vector<uint64_t>{}.swap(this->owned);
+        this->data = nullptr;
+        this->size = 0;
+        this->nodes = nullptr;
+        this->nodecount = 0;
+    }
+
+    static auto attachImage(SexpImage& image, char const* data, size_t size, std::string& err) -> bool {
+        if(size < image_header_size || std::memcmp(data, image_magic, sizeof(image_magic)) != 0) {
+            err = std::string{"not a sexp image"};
+            return false;
+        }
+        if(reinterpret_cast<uintptr_t>(data) % alignof(SexpImageNode) != 0) {
+            err = std::string{"sexp image data is not 8 byte aligned"};
+            return false;
+        }
+        uint16_t version, byteorder;
+        std::memcpy(&version, data + 4, sizeof(version));
+        std::memcpy(&byteorder, data + 6, sizeof(byteorder));
+        if(byteorder == 0xfffe) {
+            err = std::string{"sexp image has the wrong byte order"};
+            return false;
+        }
+        if(version != imageFormatVersion || byteorder != imageByteOrderMark) {
+            err = std::string{"unsupported sexp image version "} + std::to_string(version);
+            return false;
+        }
+        uint64_t nodecount, attribbytes, stringbytes;
+        std::memcpy(&nodecount, data + 8, sizeof(nodecount));
+        std::memcpy(&attribbytes, data + 16, sizeof(attribbytes));
+        std::memcpy(&stringbytes, data + 24, sizeof(stringbytes));
+        auto available = static_cast<uint64_t>(size - image_header_size);
+        if(nodecount == 0 || nodecount > available / sizeof(SexpImageNode)
+           || attribbytes > available - nodecount * sizeof(SexpImageNode)
+           || stringbytes != available - nodecount * sizeof(SexpImageNode) - attribbytes) {
+            err = std::string{"sexp image sections do not match its size"};
+            return false;
+        }
+        image.data = data;
+        image.size = size;
+        image.nodecount = nodecount;
+        image.attribbytes = attribbytes;
+        image.stringbytes = stringbytes;
+        image.nodes = reinterpret_cast<SexpImageNode const*>(data + image_header_size);
+        image.attribs = reinterpret_cast<uint8_t const*>(image.nodes + nodecount);
+        image.strings = reinterpret_cast<char const*>(image.attribs + attribbytes);
+        return true;
+    }
+
+    auto SexpImage::load(char const* data, size_t size, std::string& err) -> bool {
+        this->release();
+        return attachImage(*this, data, size, err);
+    }
+
+    auto SexpImage::load(std::string data, std::string& err) -> bool {
+        this->release();
+        this->owned.resize((data.size() + sizeof(uint64_t) - 1) / sizeof(uint64_t));
+        if(!data.empty()) std::memcpy(this->owned.data(), data.data(), data.size());
+        return attachImage(*this, reinterpret_cast<char const*>(this->owned.data()), data.size(), err);
+    }
+
+    auto SexpImage::map(std::string const& path, std::string& err) -> bool {
+        this->release();
+#ifdef SEXPRESSO_IMAGE_MMAP
+        auto fd = ::open(path.c_str(), O_RDONLY);
+        if(fd < 0) {
+            err = std::string{"could not open "} + path;
+            return false;
+        }
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            err = std::string{"could not read "} + path;
+            return false;
+        }
+        auto mapped = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if(mapped == MAP_FAILED) {
+            err = std::string{"could not map "} + path;
+            return false;
+        }
+        this->mapping = mapped;
+        this->mappingsize = static_cast<size_t>(st.st_size);
+        if(!attachImage(*this, static_cast<char const*>(mapped), this->mappingsize, err)) {
+            this->release();
+            return false;
+        }
+        return true;
+#else
+        std::ifstream file(path, std::ios::binary);
+        if(!file) {
+            err = std::string{"could not open "} + path;
+            return false;
+        }
+        auto contents = std::string{std::istreambuf_iterator<char>{file}, std::istreambuf_iterator<char>{}};
+        return this->load(std::move(contents), err);
+#endif
+    }
+
+    auto SexpImage::root() const -> SexpView {
+        return SexpView{this, this->nodecount == 0 ? UINT64_MAX : 0};
+    }
+
+    auto SexpImage::nodeCount() const -> uint64_t {
+        return this->nodecount;
+    }
+
+    auto SexpImage::node(uint64_t idx) const -> SexpImageNode const* {
+        if(idx >= this->nodecount) return nullptr;
+        return this->nodes + idx;
+    }
+
+    auto SexpView::valid() const -> bool {
+        return this->image != nullptr && this->image->node(this->index) != nullptr;
+    }
+
+    auto SexpView::kind() const -> SexpValueKind {
+        return static_cast<SexpValueKind>(this->image->nodes[this->index].kind);
+    }
+
+    auto SexpView::atomkind() const -> SexpAtomKind {
+        if(!this->isString()) return SexpAtomKind::NONE;
+        return static_cast<SexpAtomKind>(this->image->nodes[this->index].subkind);
+    }
+
+    auto SexpView::sexpkind() const -> SexpSexpKind {
+        if(!this->isSexp()) return SexpSexpKind::NONE;
+        return static_cast<SexpSexpKind>(this->image->nodes[this->index].subkind & ~imageDotted);
+    }
+
+    auto SexpView::dotted() const -> bool {
+        return this->isSexp() && (this->image->nodes[this->index].subkind & imageDotted) != 0;
+    }
+
+    auto SexpView::attributeCount() const -> size_t {
+        auto& node = this->image->nodes[this->index];
+        if(static_cast<uint64_t>(node.attriboffset) + node.attribcount > this->image->attribbytes) return 0;
+        return node.attribcount;
+    }
+
+    auto SexpView::attribute(size_t idx) const -> SexpAttributeKind {
+        return static_cast<SexpAttributeKind>(this->image->attribs[this->image->nodes[this->index].attriboffset + idx]);
+    }
+
+    auto SexpView::startpos() const -> int64_t {
+        return this->image->nodes[this->index].startpos;
+    }
+
+    auto SexpView::endpos() const -> int64_t {
+        return this->image->nodes[this->index].endpos;
+    }
+
+    auto SexpView::childCount() const -> size_t {
+        auto& node = this->image->nodes[this->index];
+        switch(this->kind()) {
+            case SexpValueKind::SEXP:
+                // children always come after their list, anything else would
+                // let a corrupt image loop back on itself
+                if(node.count != 0 && node.first <= this->index) return 0;
+                if(node.first > this->image->nodecount || node.count > this->image->nodecount - node.first) return 0;
+                return static_cast<size_t>(node.count);
+            case SexpValueKind::ATOM:
+                return 1;
+        }
+        return 0;
+    }
+
+    auto SexpView::getChild(size_t idx) const -> SexpView {
+        return SexpView{this->image, this->image->nodes[this->index].first + idx};
+    }
+
+    auto SexpView::getString() const -> SexpStringRef {
+        auto& node = this->image->nodes[this->index];
+        if(!this->isString() || node.first > this->image->stringbytes || node.count > this->image->stringbytes - node.first) {
+            return SexpStringRef{"", 0};
+        }
+        return SexpStringRef{this->image->strings + node.first, static_cast<size_t>(node.count)};
+    }
+
+    static auto segmentEquals(SexpStringRef str, char const* begin, char const* end) -> bool {
+        return str.size == static_cast<size_t>(end - begin) && std::memcmp(str.data, begin, str.size) == 0;
+    }
+
+    // same lookup rules as Sexp::getChildByPath, walking the path in place
+    auto SexpView::getChildByPath(std::string const& path) const -> SexpView {
+        auto notfound = SexpView{this->image, UINT64_MAX};
+        if(!this->valid() || !this->isSexp() || path.empty()) return notfound;
+
+        auto cur = *this;
+        auto segbegin = path.data();
+        auto pathend = path.data() + path.size();
+        auto searchfrom = segbegin + 1; // like splitPathString, a leading '/' belongs to the first segment
+        for(;;) {
+            auto segend = static_cast<char const*>(std::memchr(searchfrom, '/', pathend - searchfrom));
+            if(segend == nullptr) segend = pathend;
+            auto last = segend == pathend;
+            auto found = false;
+            auto count = cur.childCount();
+            for(size_t i = 0; i < count && !found; ++i) {
+                auto child = cur.getChild(i);
+                if(child.isString()) {
+                    if(last && segmentEquals(child.getString(), segbegin, segend)) return child;
+                    continue;
+                }
+                if(child.childCount() == 0) continue;
+                auto fst = child.getChild(0);
+                if(fst.isString() && segmentEquals(fst.getString(), segbegin, segend)) {
+                    cur = child;
+                    found = true;
+                }
+            }
+            if(!found) return notfound;
+            if(last) return cur;
+            segbegin = segend + 1;
+            searchfrom = segbegin;
+        }
+    }
+
+    auto SexpView::isString() const -> bool {
+        return this->kind() == SexpValueKind::ATOM;
+    }
+
+    auto SexpView::isSexp() const -> bool {
+        return this->kind() == SexpValueKind::SEXP;
+    }
+
+    auto SexpView::isNil() const -> bool {
+        return this->isSexp() && this->childCount() == 0;
+    }
+
+    auto SexpView::toSexp() const -> Sexp {
+        auto sexp = Sexp{this->startpos(), this->endpos()};
+        if(this->isString()) {
+            sexp = Sexp::unescaped(this->getString().str(), this->atomkind(), this->startpos(), this->endpos());
+        } else {
+            sexp.sexpkind = this->sexpkind();
+            sexp.dotted = this->dotted();
+            auto count = this->childCount();
+            sexp.value.sexp.reserve(count);
+            for(size_t i = 0; i < count; ++i) sexp.value.sexp.push_back(this->getChild(i).toSexp());
+        }
+        for(size_t i = 0; i < this->attributeCount(); ++i) sexp.attributes.push_back(this->attribute(i));
+        return sexp;
+    }
+}
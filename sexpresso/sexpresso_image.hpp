@@ -0,0 +1,104 @@
+#ifndef SEXPRESSO_IMAGE_H
+#define SEXPRESSO_IMAGE_H
+// Flat, position independent tree images that can be queried in place,
+// for example straight out of an mmapped file, without building Sexp nodes.
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    // Layout, in the byte order of the machine that wrote it:
+    //   header  "SXPI" version:u16 byteorder:u16 nodecount:u64 attribbytes:u64 stringbytes:u64
+    //   nodes   nodecount * SexpImageNode, node 0 is the root and the
+    //           children of every list are stored next to each other,
+    //           after the list itself
+    //   attribs one byte per SexpAttributeKind
+    //   strings atom bytes
+    // Loading checks the byteorder mark, so an image from a machine of the
+    // other byte order is refused.
+    const uint16_t imageFormatVersion = 1;
+    const uint16_t imageByteOrderMark = 0xfeff;
+    const uint8_t imageDotted = 0x80; // set in the subkind of dotted lists
+
+    struct SexpImageNode {
+        uint8_t kind;       // SexpValueKind
+        uint8_t subkind;    // SexpAtomKind for atoms, SexpSexpKind for lists
+        uint16_t attribcount;
+        uint32_t attriboffset;
+        uint64_t first;     // first child index, or string offset for atoms
+        uint64_t count;     // child count, or string length for atoms
+        int64_t startpos;
+        int64_t endpos;
+    };
+
+    struct SexpStringRef {
+        char const* data;
+        size_t size;
+        auto str() const -> std::string;
+        auto operator==(std::string const& other) const -> bool;
+        auto operator!=(std::string const& other) const -> bool;
+    };
+
+    struct SexpImage;
+
+    // Cheap handle to one node of an image, only valid while the image is.
+    // Mirrors the read-only part of the Sexp interface.
+    struct SexpView {
+        SexpImage const* image;
+        uint64_t index;
+
+        auto valid() const -> bool;
+        auto kind() const -> SexpValueKind;
+        auto atomkind() const -> SexpAtomKind;
+        auto sexpkind() const -> SexpSexpKind;
+        auto dotted() const -> bool;
+        auto attributeCount() const -> size_t;
+        auto attribute(size_t idx) const -> SexpAttributeKind;
+        auto startpos() const -> int64_t;
+        auto endpos() const -> int64_t;
+        auto childCount() const -> size_t;
+        auto getChild(size_t idx) const -> SexpView; // Call only if view is a Sexp
+        auto getString() const -> SexpStringRef;
+        auto getChildByPath(std::string const& path) const -> SexpView; // invalid view if not found
+        auto isString() const -> bool;
+        auto isSexp() const -> bool;
+        auto isNil() const -> bool;
+        auto toSexp() const -> Sexp;
+    };
+
+    struct SexpImage {
+        SexpImage();
+        ~SexpImage();
+        SexpImage(SexpImage const&) = delete;
+        auto operator=(SexpImage const&) -> SexpImage& = delete;
+
+        auto load(char const* data, size_t size, std::string& err) -> bool; // borrows data
+        auto load(std::string data, std::string& err) -> bool;
+        auto map(std::string const& path, std::string& err) -> bool;
+        auto root() const -> SexpView;
+        auto nodeCount() const -> uint64_t;
+        auto node(uint64_t idx) const -> SexpImageNode const*; // nullptr when out of range
+
+        auto release() -> void;
+
+        char const* data;
+        size_t size;
+        SexpImageNode const* nodes;
+        uint8_t const* attribs;
+        char const* strings;
+        uint64_t nodecount;
+        uint64_t attribbytes;
+        uint64_t stringbytes;
+        std::vector<uint64_t> owned; // keeps copied images 8 byte aligned
+        void* mapping;
+        size_t mappingsize;
+    };
+
+    // Empty, with err set, if a node has more than 65535 attributes or the
+    // attribute table would pass 4GB, as SexpImageNode cannot address them.
+    auto toImage(Sexp const& sexp) -> std::string;
+    auto toImage(Sexp const& sexp, std::string& err) -> std::string;
+}
+#endif
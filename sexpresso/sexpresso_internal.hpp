@@ -0,0 +1,53 @@
+#ifndef SEXPRESSO_INTERNAL_H
+#define SEXPRESSO_INTERNAL_H
+// Field-level helpers shared by Sexp and SexpNode. Only the library's own
+// sources include this.
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    // Sexp::hash() of a node with these fields, given how to hash its children
+    // (a Sexp's child.hash(), or a SexpNode's child->hash).
+    template<typename Node, typename Children, typename ChildHash>
+    auto structuralHash(Node const& node, std::string const& str, Children const& children, ChildHash childHash) -> uint64_t {
+        auto h = hashCombine(0, static_cast<uint64_t>(node.kind) | static_cast<uint64_t>(node.sexpkind) << 8
+                                | static_cast<uint64_t>(node.atomkind) << 16 | static_cast<uint64_t>(node.attributes.size()) << 24
+                                | static_cast<uint64_t>(node.dotted) << 56);
+        for(auto attribute : node.attributes) h = hashCombine(h, static_cast<uint64_t>(attribute) + 1);
+        switch(node.kind) {
+            case SexpValueKind::SEXP:
+                for(auto const& child : children) h = hashCombine(h, childHash(child));
+                h = hashCombine(h, children.size());
+                break;
+            case SexpValueKind::ATOM:
+                h = hashCombine(h, hashString(str.data(), str.size()));
+                break;
+        }
+        return h != 0 ? h : 1;
+    }
+
+    // What toString() prints for an attribute, and before a list of the given kind
+    inline auto attributePrefix(SexpAttributeKind attribute) -> char const* {
+        switch(attribute) {
+            case SexpAttributeKind::QUOTE: return "'";
+            case SexpAttributeKind::BACKQUOTE: return "`";
+            case SexpAttributeKind::FUNCQUOTE: return "#'";
+            case SexpAttributeKind::COMMASPLICE: return ",";
+            case SexpAttributeKind::ATSPLICE: return ",@";
+            case SexpAttributeKind::DOTSPLICE: return ",.";
+        }
+        return "";
+    }
+
+    inline auto sexpKindPrefix(SexpSexpKind sexpkind) -> char const* {
+        switch(sexpkind) {
+            case SexpSexpKind::VECTOR: return "#";
+            case SexpSexpKind::COMPLEX: return "#c";
+            default: return "";
+        }
+    }
+}
+#endif
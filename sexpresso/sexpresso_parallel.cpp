@@ -0,0 +1,200 @@
+// Work-stealing parallel visits of sexpresso::Sexp trees
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <exception>
+#include <algorithm>
+#include <functional>
+#include "sexpresso.hpp"
+#include "sexpresso_parallel.hpp"
+
+namespace sexpresso {
+
+    namespace {
+        // Accumulators of one task in document order: its own, then those of
+        // the tasks it handed off.
+        struct TaskResult {
+            void* accumulator = nullptr;
+            std::vector<std::unique_ptr<TaskResult>> spawned;
+        };
+
+        struct Task {
+            Sexp const* list;
+            size_t begin;
+            size_t end;
+            TaskResult* result; // nullptr unless deterministic
+        };
+
+        struct Worker {
+            std::mutex mutex;
+            std::deque<Task> tasks;
+            void* accumulator = nullptr;
+        };
+
+        struct Frame {
+            Sexp const* list;
+            size_t next;
+            size_t end;
+        };
+
+        struct Pool {
+            SexpParallelOptions const& options;
+            size_t grain;
+            std::function<void*()> const& open;
+            std::function<void(Sexp const&, void*)> const& visit;
+            std::vector<std::unique_ptr<Worker>> workers;
+            std::atomic<size_t> pending;
+            std::atomic<bool> failed;
+            std::mutex errormutex;
+            std::exception_ptr error;
+
+            Pool(SexpParallelOptions const& options, size_t threads, std::function<void*()> const& open, std::function<void(Sexp const&, void*)> const& visit)
+                : options(options), grain(std::max<size_t>(options.grain, 1)), open(open), visit(visit), pending(0), failed(false) {
+                for(size_t i = 0; i < threads; ++i) this->workers.emplace_back(new Worker{});
+            }
+
+            auto accumulatorOf(size_t w) -> void* {
+                auto& worker = *this->workers[w];
+                if(worker.accumulator == nullptr) worker.accumulator = this->open();
+                return worker.accumulator;
+            }
+
+            auto spawn(size_t w, Sexp const* list, size_t begin, size_t end, TaskResult* parent) -> void {
+                auto result = static_cast<TaskResult*>(nullptr);
+                if(parent != nullptr) {
+                    parent->spawned.emplace_back(new TaskResult{});
+                    result = parent->spawned.back().get();
+                }
+                ++this->pending;
+                auto& worker = *this->workers[w];
+                std::lock_guard<std::mutex> lock(worker.mutex);
+                worker.tasks.push_back(Task{list, begin, end, result});
+            }
+
+            auto take(size_t w, Task& task) -> bool {
+                {
+                    auto& own = *this->workers[w];
+                    std::lock_guard<std::mutex> lock(own.mutex);
+                    if(!own.tasks.empty()) {
+                        task = own.tasks.back();
+                        own.tasks.pop_back();
+                        return true;
+                    }
+                }
+                for(size_t i = 1; i < this->workers.size(); ++i) {
+                    auto& victim = *this->workers[(w + i) % this->workers.size()];
+                    std::lock_guard<std::mutex> lock(victim.mutex);
+                    if(!victim.tasks.empty()) {
+                        task = victim.tasks.front();
+                        victim.tasks.pop_front();
+                        return true;
+                    }
+                }
+                return false;
+            }
+
+            auto execute(size_t w, Task const& task) -> void {
+                auto accumulator = static_cast<void*>(nullptr);
+                if(task.result != nullptr) accumulator = task.result->accumulator = this->open();
+                else accumulator = this->accumulatorOf(w);
+
+                // Halves split off a long list come after everything this task
+                // visits, nearest first, so they are attached once it is done.
+                auto halves = std::vector<Task>{};
+                auto end = task.end;
+                while(end - task.begin > this->grain) {
+                    auto mid = task.begin + (end - task.begin) / 2;
+                    halves.push_back(Task{task.list, mid, end, nullptr});
+                    end = mid;
+                }
+                auto deferred = std::unique_ptr<TaskResult>{task.result != nullptr ? new TaskResult{} : nullptr};
+                for(auto it = halves.rbegin(); it != halves.rend(); ++it) {
+                    this->spawn(w, it->list, it->begin, it->end, deferred.get());
+                }
+
+                auto stack = std::vector<Frame>{Frame{task.list, task.begin, end}};
+                size_t visited = 0;
+                while(!stack.empty()) {
+                    auto& frame = stack.back();
+                    if(frame.next == frame.end) {
+                        stack.pop_back();
+                        continue;
+                    }
+                    auto& child = frame.list->value.sexp[frame.next++];
+                    this->visit(child, accumulator);
+                    if(child.kind == SexpValueKind::SEXP && !child.value.sexp.empty()) {
+                        stack.push_back(Frame{&child, 0, child.value.sexp.size()});
+                    }
+                    if(++visited < this->grain) continue;
+                    for(auto it = stack.rbegin(); it != stack.rend(); ++it) {
+                        if(it->next < it->end) this->spawn(w, it->list, it->next, it->end, task.result);
+                    }
+                    break;
+                }
+                if(deferred != nullptr) {
+                    for(auto& half : deferred->spawned) task.result->spawned.push_back(std::move(half));
+                }
+            }
+
+            auto run(size_t w) -> void {
+                auto task = Task{};
+                while(true) {
+                    if(this->take(w, task)) {
+                        if(!this->failed) {
+                            try {
+                                this->execute(w, task);
+                            } catch(...) {
+                                std::lock_guard<std::mutex> lock(this->errormutex);
+                                if(!this->error) this->error = std::current_exception();
+                                this->failed = true;
+                            }
+                        }
+                        --this->pending;
+                    } else if(this->pending == 0) {
+                        return;
+                    } else {
+                        std::this_thread::yield();
+                    }
+                }
+            }
+        };
+    }
+
+    auto parallelVisitAccumulators(Sexp const& root, SexpParallelOptions const& options,
+                                   std::function<void*()> const& open,
+                                   std::function<void(Sexp const&, void*)> const& visit) -> std::vector<void*> {
+        auto threads = options.threads != 0 ? options.threads : std::max<size_t>(std::thread::hardware_concurrency(), 1);
+        Pool pool{options, threads, open, visit};
+        auto rootresult = TaskResult{};
+        auto rootaccumulator = options.deterministic ? (rootresult.accumulator = open()) : pool.accumulatorOf(0);
+        visit(root, rootaccumulator);
+        if(root.kind == SexpValueKind::SEXP && !root.value.sexp.empty()) {
+            pool.spawn(0, &root, 0, root.value.sexp.size(), options.deterministic ? &rootresult : nullptr);
+        }
+
+        auto helpers = std::vector<std::thread>{};
+        for(size_t i = 1; i < threads; ++i) helpers.emplace_back([&pool, i]() { pool.run(i); });
+        pool.run(0);
+        for(auto& helper : helpers) helper.join();
+        if(pool.error) std::rethrow_exception(pool.error);
+
+        auto order = std::vector<void*>{};
+        if(!options.deterministic) {
+            for(auto& worker : pool.workers) {
+                if(worker->accumulator != nullptr) order.push_back(worker->accumulator);
+            }
+            return order;
+        }
+        auto stack = std::vector<TaskResult const*>{&rootresult};
+        while(!stack.empty()) {
+            auto result = stack.back();
+            stack.pop_back();
+            if(result->accumulator != nullptr) order.push_back(result->accumulator);
+            for(auto it = result->spawned.rbegin(); it != result->spawned.rend(); ++it) stack.push_back(it->get());
+        }
+        return order;
+    }
+}
@@ -0,0 +1,60 @@
+#ifndef SEXPRESSO_PARALLEL_H
+#define SEXPRESSO_PARALLEL_H
+// Visits every node of a tree on several threads.
+//
+//   auto symbols = sexpresso::parallelVisit<size_t>(sexp,
+//       [](sexpresso::Sexp const& node, size_t& count) { if(node.isString()) ++count; },
+//       [](size_t& into, size_t&& from) { into += from; });
+//
+// The tree is cut into tasks of about options.grain nodes: a task walks its
+// part of the tree until it has visited that many nodes, then hands the rest
+// of each list it is inside off as new tasks, and lists with more than grain
+// children are split in halves. Tasks run on a work-stealing pool; each worker
+// keeps its own task deque and steals from the others when it runs dry.
+//
+// The visitor adds to an accumulator that starts value-initialized. By
+// default there is one per worker and they are reduced in worker order. With
+// options.deterministic each task gets its own and they are reduced in
+// document order, so a reducer that is associative but not commutative, like
+// appending to a vector, gives the same result as a sequential pre-order walk
+// whatever the number of threads.
+//
+// The tree must not change during the visit. An exception thrown by the
+// visitor stops the visit and is rethrown from parallelVisit.
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <functional>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    struct SexpParallelOptions {
+        size_t threads = 0; // 0 for std::thread::hardware_concurrency()
+        size_t grain = 4096;
+        bool deterministic = false;
+    };
+
+    // Untyped core of parallelVisit: open() makes a new accumulator, visit()
+    // adds a node to one. Returns the accumulators in reduction order.
+    auto parallelVisitAccumulators(Sexp const& root, SexpParallelOptions const& options,
+                                   std::function<void*()> const& open,
+                                   std::function<void(Sexp const&, void*)> const& visit) -> std::vector<void*>;
+
+    template<typename T, typename Visitor, typename Reducer>
+    auto parallelVisit(Sexp const& root, Visitor visitor, Reducer reducer, SexpParallelOptions const& options = SexpParallelOptions{}) -> T {
+        std::mutex mutex;
+        auto accumulators = std::deque<T>{};
+        auto order = parallelVisitAccumulators(root, options, [&mutex, &accumulators]() -> void* {
+            std::lock_guard<std::mutex> lock(mutex);
+            accumulators.emplace_back();
+            return &accumulators.back();
+        }, [&visitor](Sexp const& node, void* accumulator) {
+            visitor(node, *static_cast<T*>(accumulator));
+        });
+        auto result = T{};
+        for(auto accumulator : order) reducer(result, std::move(*static_cast<T*>(accumulator)));
+        return result;
+    }
+}
+#endif
@@ -0,0 +1,106 @@
+// Sharded LRU cache of sexpresso::Sexp parse results
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <list>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "sexpresso.hpp"
+#include "sexpresso_parsecache.hpp"
+
+namespace sexpresso {
+
+    SexpParseCache::SexpParseCache(size_t maxbytes, size_t shards) {
+        if(shards == 0) shards = 1;
+        this->maxbytes = (maxbytes + shards - 1) / shards;
+        this->shards.reserve(shards);
+        for(size_t i = 0; i < shards; ++i) this->shards.push_back(std::unique_ptr<Shard>{new Shard{}});
+    }
+
+    // Heap and node memory a tree holds, near enough for a size limit
+    static auto treeBytes(Sexp const& sexp) -> size_t {
+        auto bytes = sizeof(Sexp) + sexp.attributes.capacity() * sizeof(SexpAttributeKind);
+        auto str = reinterpret_cast<char const*>(&sexp.value.str);
+        if(sexp.value.str.data() < str || sexp.value.str.data() >= str + sizeof(std::string)) bytes += sexp.value.str.capacity() + 1;
+        if(sexp.extra.ptr) bytes += sizeof(SexpExtra);
+        bytes += (sexp.value.sexp.capacity() - sexp.value.sexp.size()) * sizeof(Sexp);
+        for(auto const& child : sexp.value.sexp) bytes += treeBytes(child);
+        return bytes;
+    }
+
+    static auto findEntry(SexpParseCache::Shard& shard, uint64_t hash, std::string const& str) -> std::list<SexpParseCache::Entry>::iterator {
+        auto range = shard.lookup.equal_range(hash);
+        for(auto it = range.first; it != range.second; ++it) {
+            if(it->second->input == str) return it->second;
+        }
+        return shard.lru.end();
+    }
+
+    auto SexpParseCache::parse(std::string const& str, std::string& err) -> std::shared_ptr<Sexp const> {
+        auto hash = hashString(str.data(), str.size());
+        auto& shard = *this->shards[(hash >> 32) % this->shards.size()];
+        {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            auto found = findEntry(shard, hash, str);
+            if(found != shard.lru.end()) {
+                shard.lru.splice(shard.lru.begin(), shard.lru, found);
+                ++shard.stats.hits;
+                return found->sexp;
+            }
+            ++shard.stats.misses;
+        }
+
+        auto sexp = std::make_shared<Sexp const>(sexpresso::parse(str, err));
+        if(!err.empty()) return nullptr;
+        auto bytes = sizeof(Entry) + str.size() + treeBytes(*sexp);
+        if(bytes > this->maxbytes) return sexp;
+
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = findEntry(shard, hash, str);
+        if(found != shard.lru.end()) {
+            // another thread parsed the same input meanwhile, share its tree
+            shard.lru.splice(shard.lru.begin(), shard.lru, found);
+            return found->sexp;
+        }
+        shard.lru.push_front(Entry{hash, str, sexp, bytes});
+        shard.lookup.emplace(hash, shard.lru.begin());
+        shard.stats.bytes += bytes;
+        while(shard.stats.bytes > this->maxbytes) {
+            auto last = std::prev(shard.lru.end());
+            auto range = shard.lookup.equal_range(last->hash);
+            for(auto it = range.first; it != range.second; ++it) {
+                if(it->second != last) continue;
+                shard.lookup.erase(it);
+                break;
+            }
+            shard.stats.bytes -= last->bytes;
+            shard.lru.pop_back();
+            ++shard.stats.evictions;
+        }
+        return sexp;
+    }
+
+    auto SexpParseCache::stats() const -> SexpParseCacheStats {
+        auto total = SexpParseCacheStats{};
+        for(auto& shard : this->shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            total.hits += shard->stats.hits;
+            total.misses += shard->stats.misses;
+            total.evictions += shard->stats.evictions;
+            total.entries += shard->lru.size();
+            total.bytes += shard->stats.bytes;
+        }
+        return total;
+    }
+
+    auto SexpParseCache::clear() -> void {
+        for(auto& shard : this->shards) {
+            std::lock_guard<std::mutex> lock(shard->mutex);
+            shard->lru.clear();
+            shard->lookup.clear();
+            shard->stats.bytes = 0;
+        }
+    }
+}
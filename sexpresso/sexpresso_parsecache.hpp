@@ -0,0 +1,62 @@
+#ifndef SEXPRESSO_PARSECACHE_H
+#define SEXPRESSO_PARSECACHE_H
+// In-memory cache of parse results for inputs that repeat byte for byte,
+// such as protocol messages.
+//
+//   sexpresso::SexpParseCache cache{16 << 20}; // up to 16 MiB
+//   auto err = std::string{};
+//   auto sexp = cache.parse(message, err); // shared, never modified again
+//
+// Entries are spread over shards by hashString() of the input, each shard an
+// LRU list behind its own mutex, so lookups from many threads rarely wait on
+// each other. A hit compares the whole input against the cached one, then
+// returns the cached tree without parsing. Parsing a miss happens outside
+// the lock. Inputs that fail to parse are not cached.
+//
+// The size limit counts each entry's copy of its input plus an estimate of
+// its tree's heap use, so a few large inputs cannot take more memory than
+// many small ones. Inputs too large for a shard on their own are parsed but
+// not cached.
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    struct SexpParseCacheStats {
+        size_t hits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+        size_t entries = 0;
+        size_t bytes = 0; // as counted against the size limit
+    };
+
+    struct SexpParseCache {
+        explicit SexpParseCache(size_t maxbytes = 64 << 20, size_t shards = 16); // maxbytes split evenly over the shards
+
+        auto parse(std::string const& str, std::string& err) -> std::shared_ptr<Sexp const>; // nullptr on error
+        auto stats() const -> SexpParseCacheStats;
+        auto clear() -> void;
+
+        struct Entry {
+            uint64_t hash;
+            std::string input;
+            std::shared_ptr<Sexp const> sexp;
+            size_t bytes;
+        };
+        struct Shard {
+            mutable std::mutex mutex;
+            std::list<Entry> lru; // most recently used first
+            std::unordered_multimap<uint64_t, std::list<Entry>::iterator> lookup;
+            SexpParseCacheStats stats;
+        };
+        std::vector<std::unique_ptr<Shard>> shards;
+        size_t maxbytes; // per shard
+    };
+}
+#endif
@@ -0,0 +1,346 @@
+// Structural pattern matching for sexpresso::Sexp trees
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include <algorithm>
+#include <array>
+#include "sexpresso.hpp"
+#include "sexpresso_pattern.hpp"
+
+namespace sexpresso {
+
+    static const std::array<char const*, 8> guard_atomkinds = { "", "symbol", "string", "char", "binary", "octal", "hex", "pathname" };
+    static const std::array<char const*, 3> guard_sexpkinds = { "", "vector", "complex" };
+
+    auto SexpPatternToken::operator==(SexpPatternToken const& other) const -> bool {
+        return this->kind == other.kind && this->guard == other.guard && this->subkind == other.subkind
+            && this->str == other.str && this->attributes == other.attributes;
+    }
+
+    auto SexpCapture::begin() const -> Sexp const* { return this->first; }
+
+    auto SexpCapture::end() const -> Sexp const* { return this->first + this->count; }
+
+    auto SexpMatch::get(std::string const& name) const -> SexpCapture const* {
+        for(auto const& capture : this->captures) {
+            if(capture.name == name) return &capture;
+        }
+        return nullptr;
+    }
+
+    // Parsed atoms hold their text escaped, so ?x is stored as \?x; atoms made
+    // with Sexp::unescaped keep the bare ?x.
+    static auto variablePrefix(Sexp const& sexp) -> size_t {
+        if(sexp.kind != SexpValueKind::ATOM || sexp.atomkind != SexpAtomKind::SYMBOL) return 0;
+        auto& str = sexp.value.str;
+        if(str.size() > 2 && str[0] == '\\' && str[1] == '?') return 2;
+        if(str.size() > 1 && str[0] == '?') return 1;
+        return 0;
+    }
+
+    static auto isVariable(Sexp const& sexp) -> bool {
+        return variablePrefix(sexp) != 0;
+    }
+
+    static auto isSymbol(Sexp const& sexp, char const* name) -> bool {
+        return sexp.kind == SexpValueKind::ATOM && sexp.atomkind == SexpAtomKind::SYMBOL && sexp.value.str == name;
+    }
+
+    static auto parseGuard(std::string const& name, SexpPatternToken& token) -> bool {
+        if(name == "atom") { token.guard = SexpPatternGuard::ATOM; return true; }
+        if(name == "list") { token.guard = SexpPatternGuard::LIST; return true; }
+        for(size_t i = 1; i < guard_atomkinds.size(); ++i) {
+            if(name != guard_atomkinds[i]) continue;
+            token.guard = SexpPatternGuard::ATOMKIND;
+            token.subkind = static_cast<uint8_t>(i);
+            return true;
+        }
+        for(size_t i = 1; i < guard_sexpkinds.size(); ++i) {
+            if(name != guard_sexpkinds[i]) continue;
+            token.guard = SexpPatternGuard::SEXPKIND;
+            token.subkind = static_cast<uint8_t>(i);
+            return true;
+        }
+        return false;
+    }
+
+    static auto flattenPattern(Sexp const& pattern, std::vector<SexpPatternToken>& tokens, std::vector<std::string>& names, std::string& err) -> bool {
+        auto token = SexpPatternToken{};
+        token.guard = SexpPatternGuard::ANY;
+        token.subkind = 0;
+        token.attributes = pattern.attributes;
+
+        if(isVariable(pattern)) {
+            token.kind = SexpPatternTokenKind::CAPTURE;
+            auto name = pattern.value.str.substr(variablePrefix(pattern));
+            auto colon = name.find(':');
+            if(colon != std::string::npos) {
+                if(!parseGuard(name.substr(colon + 1), token)) {
+                    err = std::string{"unknown guard in pattern variable ?"} + name;
+                    return false;
+                }
+                name.resize(colon);
+            }
+            names.push_back(name);
+            tokens.push_back(std::move(token));
+            return true;
+        }
+        if(pattern.kind == SexpValueKind::ATOM) {
+            token.kind = SexpPatternTokenKind::ATOM;
+            token.subkind = static_cast<uint8_t>(pattern.atomkind);
+            token.str = pattern.value.str;
+            tokens.push_back(std::move(token));
+            return true;
+        }
+
+        token.kind = SexpPatternTokenKind::LIST;
+        token.subkind = static_cast<uint8_t>(pattern.sexpkind);
+        tokens.push_back(std::move(token));
+        // a proper list after the dot is read as more elements, as (a . (b c)) is (a b c)
+        auto elements = std::vector<Sexp const*>{};
+        auto tail = static_cast<Sexp const*>(nullptr);
+        for(auto list = &pattern; list != nullptr;) {
+            auto& items = list->value.sexp;
+            auto count = items.size();
+            auto next = static_cast<Sexp const*>(nullptr);
+            // parsed patterns hold . x as a dotted tail, built ones may spell out the .
+            if(list->dotted && count >= 2) {
+                next = &items[count - 1];
+                count -= 1;
+            } else if(count >= 3 && isSymbol(items[count - 2], ".")) {
+                next = &items[count - 1];
+                count -= 2;
+            }
+            for(size_t i = 0; i < count; ++i) elements.push_back(&items[i]);
+            list = nullptr;
+            if(next != nullptr && next->kind == SexpValueKind::SEXP && next->sexpkind == SexpSexpKind::NONE && next->attributes.empty()) list = next;
+            else tail = next;
+        }
+        auto rest = std::string{};
+        if(tail != nullptr && (isVariable(*tail) || isSymbol(*tail, "..."))) {
+            // . ?var is the rest of the list, whether that ends in a dotted tail or not
+            if(tail->value.str.find(':') != std::string::npos) {
+                err = std::string{"a rest variable cannot have a guard"};
+                return false;
+            }
+            rest = isVariable(*tail) ? tail->value.str.substr(variablePrefix(*tail)) : std::string{"_"};
+            tail = nullptr;
+        } else if(tail == nullptr && !elements.empty() && isSymbol(*elements.back(), "...")) {
+            rest = "_";
+            elements.pop_back();
+        }
+        for(auto element : elements) {
+            if(!flattenPattern(*element, tokens, names, err)) return false;
+        }
+        auto end = SexpPatternToken{};
+        end.guard = SexpPatternGuard::ANY;
+        end.subkind = 0;
+        if(tail != nullptr) {
+            auto mark = end;
+            mark.kind = SexpPatternTokenKind::TAIL;
+            tokens.push_back(std::move(mark));
+            if(!flattenPattern(*tail, tokens, names, err)) return false;
+        }
+        if(rest.empty()) {
+            end.kind = SexpPatternTokenKind::END;
+        } else {
+            end.kind = SexpPatternTokenKind::REST;
+            names.push_back(rest);
+        }
+        tokens.push_back(std::move(end));
+        return true;
+    }
+
+    SexpPatternSet::SexpPatternSet() {
+        this->nodes.resize(1);
+    }
+
+    auto SexpPatternSet::size() const -> size_t {
+        return this->names.size();
+    }
+
+    auto SexpPatternSet::add(std::string const& pattern, std::string& err) -> size_t {
+        auto parsed = parse(pattern, err);
+        if(!err.empty()) return SIZE_MAX;
+        if(parsed.childCount() != 1) {
+            err = std::string{"a pattern must be exactly one s-expression"};
+            return SIZE_MAX;
+        }
+        return this->add(parsed.getChild(0), err);
+    }
+
+    auto SexpPatternSet::add(Sexp const& pattern, std::string& err) -> size_t {
+        auto tokens = std::vector<SexpPatternToken>{};
+        auto names = std::vector<std::string>{};
+        if(!flattenPattern(pattern, tokens, names, err)) return SIZE_MAX;
+
+        size_t cur = 0;
+        for(auto& token : tokens) {
+            auto& edges = token.kind == SexpPatternTokenKind::ATOM ? this->nodes[cur].atoms[token.str] : this->nodes[cur].others;
+            auto found = std::find_if(edges.begin(), edges.end(), [this, &token](size_t idx) { return this->nodes[idx].token == token; });
+            if(found != edges.end()) {
+                cur = *found;
+                continue;
+            }
+            auto next = this->nodes.size();
+            edges.push_back(next);
+            this->nodes.push_back(SexpPatternNode{});
+            this->nodes.back().token = std::move(token);
+            cur = next;
+        }
+        auto id = this->names.size();
+        this->nodes[cur].patterns.push_back(id);
+        this->names.push_back(std::move(names));
+        return id;
+    }
+
+    namespace {
+        struct MatchFrame {
+            Sexp const* items;
+            size_t next;
+            size_t size;       // without the tail of a dotted list
+            Sexp const* tail;  // that tail, until a TAIL token moves on to it
+        };
+
+        struct PatternMatcher {
+            SexpPatternSet const& set;
+            std::vector<MatchFrame> frames;
+            std::vector<SexpCapture> captures;
+            std::vector<SexpMatch> matches;
+
+            auto attributesMatch(SexpPatternToken const& token, Sexp const& node) -> bool {
+                return token.attributes.empty() || token.attributes == node.attributes;
+            }
+
+            auto guardMatches(SexpPatternToken const& token, Sexp const& node) -> bool {
+                switch(token.guard) {
+                    case SexpPatternGuard::ANY: return true;
+                    case SexpPatternGuard::ATOM: return node.kind == SexpValueKind::ATOM;
+                    case SexpPatternGuard::LIST: return node.kind == SexpValueKind::SEXP;
+                    case SexpPatternGuard::ATOMKIND:
+                        return node.kind == SexpValueKind::ATOM && static_cast<uint8_t>(node.atomkind) == token.subkind;
+                    case SexpPatternGuard::SEXPKIND:
+                        return node.kind == SexpValueKind::SEXP && static_cast<uint8_t>(node.sexpkind) == token.subkind;
+                }
+                return false;
+            }
+
+            auto capturesEqual(SexpCapture const& a, SexpCapture const& b) -> bool {
+                if(a.count != b.count || a.dotted != b.dotted) return false;
+                for(size_t i = 0; i < a.count; ++i) {
+                    if(!a.first[i].equal(b.first[i])) return false;
+                }
+                return true;
+            }
+
+            auto emit(size_t pattern) -> void {
+                auto match = SexpMatch{};
+                match.pattern = pattern;
+                auto& names = this->set.names[pattern];
+                for(size_t i = 0; i < names.size(); ++i) {
+                    if(names[i] == "_") continue;
+                    auto capture = this->captures[i];
+                    capture.name = names[i];
+                    auto previous = match.get(capture.name);
+                    if(previous != nullptr) {
+                        if(!capturesEqual(*previous, capture)) return;
+                        continue;
+                    }
+                    match.captures.push_back(std::move(capture));
+                }
+                this->matches.push_back(std::move(match));
+            }
+
+            auto walk(size_t nodeidx) -> void {
+                auto& node = this->set.nodes[nodeidx];
+                if(this->frames.size() == 1 && this->frames[0].next == 1) {
+                    for(auto pattern : node.patterns) this->emit(pattern);
+                }
+                auto top = this->frames.size() - 1;
+                auto subject = this->frames[top].next < this->frames[top].size ? &this->frames[top].items[this->frames[top].next] : nullptr;
+
+                if(subject != nullptr && subject->kind == SexpValueKind::ATOM) {
+                    auto found = node.atoms.find(subject->value.str);
+                    if(found != node.atoms.end()) {
+                        for(auto child : found->second) {
+                            auto& token = this->set.nodes[child].token;
+                            if(static_cast<uint8_t>(subject->atomkind) != token.subkind || !this->attributesMatch(token, *subject)) continue;
+                            ++this->frames[top].next;
+                            this->walk(child);
+                            --this->frames[top].next;
+                        }
+                    }
+                }
+
+                for(auto child : node.others) {
+                    auto& token = this->set.nodes[child].token;
+                    switch(token.kind) {
+                        case SexpPatternTokenKind::LIST:
+                            if(subject == nullptr || subject->kind != SexpValueKind::SEXP) break;
+                            if(static_cast<uint8_t>(subject->sexpkind) != token.subkind || !this->attributesMatch(token, *subject)) break;
+                            ++this->frames[top].next;
+                            this->frames.push_back(MatchFrame{subject->value.sexp.data(), 0, subject->value.sexp.size(), subject->getTail()});
+                            if(this->frames.back().tail != nullptr) --this->frames.back().size;
+                            this->walk(child);
+                            this->frames.pop_back();
+                            --this->frames[top].next;
+                            break;
+                        case SexpPatternTokenKind::CAPTURE:
+                            if(subject == nullptr || !this->guardMatches(token, *subject) || !this->attributesMatch(token, *subject)) break;
+                            ++this->frames[top].next;
+                            this->captures.push_back(SexpCapture{std::string{}, subject, 1, false});
+                            this->walk(child);
+                            this->captures.pop_back();
+                            --this->frames[top].next;
+                            break;
+                        case SexpPatternTokenKind::END:
+                        case SexpPatternTokenKind::REST: {
+                            if(top == 0) break;
+                            auto frame = this->frames[top];
+                            auto dotted = frame.tail != nullptr;
+                            if(token.kind == SexpPatternTokenKind::END && (dotted || frame.next != frame.size)) break;
+                            if(token.kind == SexpPatternTokenKind::REST) {
+                                // the tail sits right after the other elements, so it is part of the same run
+                                auto count = frame.size - frame.next + (dotted ? 1 : 0);
+                                this->captures.push_back(SexpCapture{std::string{}, frame.items + frame.next, count, dotted});
+                            }
+                            this->frames.pop_back();
+                            this->walk(child);
+                            this->frames.push_back(frame);
+                            if(token.kind == SexpPatternTokenKind::REST) this->captures.pop_back();
+                            break;
+                        }
+                        case SexpPatternTokenKind::TAIL: {
+                            auto frame = this->frames[top];
+                            if(frame.tail == nullptr || frame.next != frame.size) break;
+                            this->frames[top] = MatchFrame{frame.tail, 0, 1, nullptr};
+                            this->walk(child);
+                            this->frames[top] = frame;
+                            break;
+                        }
+                        case SexpPatternTokenKind::ATOM:
+                            break;
+                    }
+                }
+            }
+        };
+    }
+
+    auto SexpPatternSet::match(Sexp const& node) const -> std::vector<SexpMatch> {
+        auto matcher = PatternMatcher{*this, std::vector<MatchFrame>{MatchFrame{&node, 0, 1, nullptr}}, {}, {}};
+        matcher.walk(0);
+        std::sort(matcher.matches.begin(), matcher.matches.end(), [](SexpMatch const& a, SexpMatch const& b) { return a.pattern < b.pattern; });
+        return std::move(matcher.matches);
+    }
+
+    auto matchPattern(std::string const& pattern, Sexp const& node, SexpMatch& match) -> bool {
+        auto set = SexpPatternSet{};
+        auto err = std::string{};
+        if(set.add(pattern, err) == SIZE_MAX) return false;
+        auto matches = set.match(node);
+        if(matches.empty()) return false;
+        match = std::move(matches[0]);
+        return true;
+    }
+}
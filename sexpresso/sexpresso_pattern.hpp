@@ -0,0 +1,79 @@
+#ifndef SEXPRESSO_PATTERN_H
+#define SEXPRESSO_PATTERN_H
+// Structural pattern matching of Sexp trees. Patterns are s-expressions:
+//
+//   (defun ?name ?args . ?body)   ?var captures one node, . ?var the rest of a list
+//   (let ((?v ?e)) ...)           ... matches the rest of a list without capturing it
+//   (setf ?place ?_)              ?_ matches anything and captures nothing
+//   (load ?file:string)           guards: symbol string char binary octal hex
+//                                 pathname atom list vector complex
+//   (eq ?x ?x)                    a repeated variable must match equal nodes
+//   '(quote-me ?x)                a node with attributes needs exactly those attributes
+//   (?key . 10)                   after the dot, anything but a variable or a
+//                                 list matches the tail of a dotted list
+//
+// Other atoms match literally. As in Lisp, the rest of (a b . c) after a is
+// b and then the tail c: (?x . ?r) and (?x ...) match it, r holding both
+// nodes and marked dotted, while (?x ?y) does not. A SexpPatternSet merges
+// all of its patterns into one discrimination tree, so matching a node
+// against many patterns walks the node once, dispatching on literal atoms
+// through a hash lookup.
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <unordered_map>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    enum class SexpPatternTokenKind : uint8_t { LIST, ATOM, CAPTURE, END, REST, TAIL };
+    enum class SexpPatternGuard : uint8_t { ANY, ATOM, LIST, ATOMKIND, SEXPKIND };
+
+    // Patterns are flattened to tokens in pre-order; a list is LIST, its
+    // elements, then END, or REST if it ends in a rest variable. A dotted
+    // list has TAIL and the tokens of its tail before the END.
+    struct SexpPatternToken {
+        SexpPatternTokenKind kind;
+        SexpPatternGuard guard;
+        uint8_t subkind; // atom or sexp kind for ATOM, LIST and kind guards
+        std::string str;
+        std::vector<SexpAttributeKind> attributes;
+        auto operator==(SexpPatternToken const& other) const -> bool;
+    };
+
+    struct SexpPatternNode {
+        SexpPatternToken token; // token on the edge into this node
+        std::unordered_map<std::string, std::vector<size_t>> atoms; // ATOM edges by atom text
+        std::vector<size_t> others; // all other edges
+        std::vector<size_t> patterns; // patterns that end here
+    };
+
+    struct SexpCapture {
+        std::string name;
+        Sexp const* first;
+        size_t count; // 1 for ?var, any number for a rest variable
+        bool dotted;  // a rest variable that took the tail of a dotted list, as the last node
+        auto begin() const -> Sexp const*;
+        auto end() const -> Sexp const*;
+    };
+
+    struct SexpMatch {
+        size_t pattern;
+        std::vector<SexpCapture> captures;
+        auto get(std::string const& name) const -> SexpCapture const*; // nullptr if not captured
+    };
+
+    struct SexpPatternSet {
+        SexpPatternSet();
+        auto add(std::string const& pattern, std::string& err) -> size_t; // pattern id, or SIZE_MAX on error
+        auto add(Sexp const& pattern, std::string& err) -> size_t;
+        auto match(Sexp const& node) const -> std::vector<SexpMatch>; // ordered by pattern id
+        auto size() const -> size_t;
+
+        std::vector<SexpPatternNode> nodes; // nodes[0] is the root
+        std::vector<std::vector<std::string>> names; // capture names of each pattern, in pre-order
+    };
+
+    auto matchPattern(std::string const& pattern, Sexp const& node, SexpMatch& match) -> bool;
+}
+#endif
@@ -0,0 +1,55 @@
+// Byte offset lookups over parsed sexpresso::Sexp trees
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include "sexpresso.hpp"
+#include "sexpresso_walk.hpp"
+#include "sexpresso_positions.hpp"
+
+namespace sexpresso {
+
+    SexpPositionIndex::SexpPositionIndex(Sexp& root) {
+        auto open = std::vector<size_t>{}; // nearest indexed ancestor-or-self at each depth
+        auto walk = preorder(root);
+        for(auto node = walk.next(); node != nullptr; node = walk.next()) {
+            auto depth = walk.depth();
+            open.resize(depth + 1);
+            auto parent = depth == 0 ? SIZE_MAX : open[depth - 1];
+            if(node->endpos <= node->startpos) {
+                open[depth] = parent;
+                continue;
+            }
+            open[depth] = this->entries.size();
+            this->entries.push_back(Entry{node->startpos, node->endpos, node, parent});
+        }
+    }
+
+    auto SexpPositionIndex::nodeAt(int64_t offset) const -> Sexp* {
+        // The innermost node containing offset is the last one starting at or
+        // before it, or an ancestor of that one.
+        auto it = std::upper_bound(this->entries.begin(), this->entries.end(), offset, [](int64_t off, Entry const& e) { return off < e.start; });
+        if(it == this->entries.begin()) return nullptr;
+        auto idx = static_cast<size_t>(it - this->entries.begin()) - 1;
+        while(idx != SIZE_MAX && this->entries[idx].end <= offset) idx = this->entries[idx].parent;
+        return idx == SIZE_MAX ? nullptr : this->entries[idx].node;
+    }
+
+    auto SexpPositionIndex::nodesInRange(int64_t begin, int64_t end) const -> std::vector<Sexp*> {
+        auto result = std::vector<Sexp*>{};
+        auto it = std::lower_bound(this->entries.begin(), this->entries.end(), begin, [](Entry const& e, int64_t off) { return e.start < off; });
+        for(; it != this->entries.end() && it->start < end; ++it) {
+            if(it->end <= end) result.push_back(it->node);
+        }
+        return result;
+    }
+
+    auto SexpPositionIndex::enclosingForms(int64_t offset) const -> std::vector<Sexp*> {
+        auto result = std::vector<Sexp*>{};
+        auto it = std::upper_bound(this->entries.begin(), this->entries.end(), offset, [](int64_t off, Entry const& e) { return off < e.start; });
+        if(it == this->entries.begin()) return result;
+        for(auto idx = static_cast<size_t>(it - this->entries.begin()) - 1; idx != SIZE_MAX; idx = this->entries[idx].parent) {
+            if(this->entries[idx].end > offset) result.push_back(this->entries[idx].node);
+        }
+        return result;
+    }
+}
@@ -0,0 +1,33 @@
+#ifndef SEXPRESSO_POSITIONS_H
+#define SEXPRESSO_POSITIONS_H
+// Finds nodes by byte offset in the parsed source, e.g. the node under an
+// editor's cursor.
+//
+// Spans are [startpos, endpos) as parse() sets them, so a node's span starts
+// at its quote, #' or #( prefix and a cursor on the prefix finds that node.
+// Offsets in whitespace between children find the enclosing list. Nodes
+// without a span, like ones added in code, are left out. Rebuild the index
+// after editing the tree.
+
+#include <vector>
+#include <cstdint>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    struct SexpPositionIndex {
+        explicit SexpPositionIndex(Sexp& root);
+
+        auto nodeAt(int64_t offset) const -> Sexp*; // innermost node, nullptr if none contains offset
+        auto nodesInRange(int64_t begin, int64_t end) const -> std::vector<Sexp*>; // lying entirely in [begin, end), document order
+        auto enclosingForms(int64_t offset) const -> std::vector<Sexp*>; // innermost first, ending with the root
+
+        struct Entry {
+            int64_t start;
+            int64_t end;
+            Sexp* node;
+            size_t parent; // SIZE_MAX for the root
+        };
+        std::vector<Entry> entries; // pre-order, which sorts them by start
+    };
+}
+#endif
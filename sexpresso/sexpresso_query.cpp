@@ -0,0 +1,418 @@
+// XPath-like queries over sexpresso::Sexp trees
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <unordered_map>
+#include "sexpresso.hpp"
+#include "sexpresso_query.hpp"
+
+namespace sexpresso {
+
+    static const std::array<char const*, 6> attribute_names = { "quote", "backquote", "funcquote", "comma", "atsplice", "dotsplice" };
+    static const std::array<char const*, 8> atomkind_names = { "", "symbol", "string", "char", "binary", "octal", "hex", "pathname" };
+    static const std::array<char const*, 3> sexpkind_names = { "", "vector", "complex" };
+
+    template<size_t N>
+    static auto lookupName(std::array<char const*, N> const& names, std::string const& name) -> size_t {
+        for(size_t i = 0; i < N; ++i) {
+            if(!name.empty() && name == names[i]) return i;
+        }
+        return N;
+    }
+
+    static auto parsePredicate(std::string const& text, SexpQueryPredicate& pred, std::string& err) -> bool {
+        if(text.empty()) {
+            err = std::string{"empty predicate in query"};
+            return false;
+        }
+        if(std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; })) {
+            pred.kind = SexpQueryPredicateKind::POSITION;
+            pred.position = std::stoul(text);
+            if(pred.position == 0) {
+                err = std::string{"query positions start at 1"};
+                return false;
+            }
+            return true;
+        }
+        if(text[0] == '@') {
+            auto idx = lookupName(attribute_names, text.substr(1));
+            if(idx == attribute_names.size()) {
+                err = std::string{"unknown attribute '"} + text.substr(1) + "' in query";
+                return false;
+            }
+            pred.kind = SexpQueryPredicateKind::ATTRIBUTE;
+            pred.attribute = static_cast<SexpAttributeKind>(idx);
+            return true;
+        }
+        if(text[0] == ':') {
+            auto name = text.substr(1);
+            auto idx = lookupName(atomkind_names, name);
+            if(idx != atomkind_names.size()) {
+                pred.kind = SexpQueryPredicateKind::ATOMKIND;
+                pred.atomkind = static_cast<SexpAtomKind>(idx);
+                return true;
+            }
+            idx = lookupName(sexpkind_names, name);
+            if(idx != sexpkind_names.size()) {
+                pred.kind = SexpQueryPredicateKind::SEXPKIND;
+                pred.sexpkind = static_cast<SexpSexpKind>(idx);
+                return true;
+            }
+            err = std::string{"unknown kind '"} + name + "' in query";
+            return false;
+        }
+        auto eq = text.find('=');
+        if(eq == std::string::npos) {
+            pred.kind = SexpQueryPredicateKind::CHILD;
+            pred.name = text;
+        } else {
+            pred.kind = SexpQueryPredicateKind::CHILD_VALUE;
+            pred.name = text.substr(0, eq);
+            pred.value = text.substr(eq + 1);
+        }
+        return true;
+    }
+
+    auto compileQuery(std::string const& query) -> SexpQuery {
+        auto ignored_error = std::string{};
+        return compileQuery(query, ignored_error);
+    }
+
+    auto compileQuery(std::string const& query, std::string& err) -> SexpQuery {
+        auto compiled = SexpQuery{};
+        size_t pos = 0;
+        auto descendant = false;
+        if(query.compare(0, 2, "//") == 0) {
+            descendant = true;
+            pos = 2;
+        } else if(query.compare(0, 1, "/") == 0) {
+            pos = 1;
+        }
+        while(pos < query.size()) {
+            auto step = SexpQueryStep{};
+            step.descendant = descendant;
+            auto nameend = query.find_first_of("/[", pos);
+            if(nameend == std::string::npos) nameend = query.size();
+            step.name = query.substr(pos, nameend - pos);
+            step.wildcard = step.name == "*";
+            if(step.name.empty()) {
+                err = std::string{"empty step in query"};
+                return SexpQuery{};
+            }
+            pos = nameend;
+            while(pos < query.size() && query[pos] == '[') {
+                auto close = query.find(']', pos);
+                if(close == std::string::npos) {
+                    err = std::string{"unterminated predicate in query"};
+                    return SexpQuery{};
+                }
+                auto pred = SexpQueryPredicate{};
+                if(!parsePredicate(query.substr(pos + 1, close - pos - 1), pred, err)) return SexpQuery{};
+                step.predicates.push_back(std::move(pred));
+                pos = close + 1;
+            }
+            auto positions = std::count_if(step.predicates.begin(), step.predicates.end(), [](SexpQueryPredicate const& pred) {
+                return pred.kind == SexpQueryPredicateKind::POSITION;
+            });
+            if(positions > 1) {
+                err = std::string{"only one positional predicate per query step"};
+                return SexpQuery{};
+            }
+            compiled.steps.push_back(std::move(step));
+
+            if(pos == query.size()) break;
+            if(query[pos] != '/') {
+                err = std::string{"expected '/' after predicate in query"};
+                return SexpQuery{};
+            }
+            descendant = query.compare(pos, 2, "//") == 0;
+            pos += descendant ? 2 : 1;
+            if(pos == query.size()) {
+                err = std::string{"query ends with '/'"};
+                return SexpQuery{};
+            }
+        }
+        return compiled;
+    }
+
+    static auto headIs(Sexp const& sexp, std::string const& name) -> bool {
+        return sexp.kind == SexpValueKind::SEXP && !sexp.value.sexp.empty()
+            && sexp.value.sexp[0].kind == SexpValueKind::ATOM && sexp.value.sexp[0].value.str == name;
+    }
+
+    static auto predicateMatches(SexpQueryPredicate const& pred, Sexp const& node, size_t& counter) -> bool {
+        switch(pred.kind) {
+            case SexpQueryPredicateKind::POSITION:
+                return ++counter == pred.position;
+            case SexpQueryPredicateKind::ATTRIBUTE:
+                return std::find(node.attributes.begin(), node.attributes.end(), pred.attribute) != node.attributes.end();
+            case SexpQueryPredicateKind::ATOMKIND:
+                return node.kind == SexpValueKind::ATOM && node.atomkind == pred.atomkind;
+            case SexpQueryPredicateKind::SEXPKIND:
+                return node.kind == SexpValueKind::SEXP && node.sexpkind == pred.sexpkind;
+            case SexpQueryPredicateKind::CHILD:
+            case SexpQueryPredicateKind::CHILD_VALUE:
+                if(node.kind != SexpValueKind::SEXP) return false;
+                for(size_t i = 1; i < node.value.sexp.size(); ++i) {
+                    auto& child = node.value.sexp[i];
+                    if(!headIs(child, pred.name)) continue;
+                    if(pred.kind == SexpQueryPredicateKind::CHILD) return true;
+                    if(child.value.sexp.size() >= 2 && child.value.sexp[1].kind == SexpValueKind::ATOM
+                       && child.value.sexp[1].value.str == pred.value) return true;
+                }
+                return false;
+        }
+        return false;
+    }
+
+    // Does node, the head of its list if head is set, pass step? Counts it
+    // towards the step's positional predicate in counter.
+    static auto queryStepMatches(SexpQueryStep const& step, Sexp const& node, bool laststep, bool head, size_t& counter) -> bool {
+        if(!step.wildcard) {
+            switch(node.kind) {
+                case SexpValueKind::ATOM:
+                    if(!laststep || head || node.value.str != step.name) return false;
+                    break;
+                case SexpValueKind::SEXP:
+                    if(!headIs(node, step.name)) return false;
+                    break;
+            }
+        }
+        for(auto const& pred : step.predicates) {
+            if(!predicateMatches(pred, node, counter)) return false;
+        }
+        return true;
+    }
+
+    static auto addState(std::vector<uint32_t>& states, uint32_t state) -> void {
+        if(std::find(states.begin(), states.end(), state) == states.end()) states.push_back(state);
+    }
+
+    SexpQueryMatches::SexpQueryMatches(Sexp& root, SexpQuery const& query) : query(query), depth(0) {
+        if(query.steps.empty() || root.kind != SexpValueKind::SEXP) return;
+        this->frames.resize(1);
+        auto& frame = this->frames[0];
+        frame.node = &root;
+        frame.next = 0;
+        frame.states.push_back(0);
+        frame.counters.assign(query.steps.size(), 0);
+        this->depth = 1;
+    }
+
+    auto SexpQueryMatches::next() -> Sexp* {
+        auto& steps = this->query.steps;
+        while(this->depth > 0) {
+            if(this->frames.size() == this->depth) this->frames.emplace_back();
+            auto& frame = this->frames[this->depth - 1];
+            if(frame.next == frame.node->value.sexp.size()) {
+                --this->depth;
+                continue;
+            }
+            auto& child = frame.node->value.sexp[frame.next++];
+            auto& childframe = this->frames[this->depth];
+            childframe.states.clear();
+            auto matched = false;
+            for(auto s : frame.states) {
+                auto& step = steps[s];
+                auto last = s + 1 == steps.size();
+                if(step.descendant) addState(childframe.states, s);
+                if(queryStepMatches(step, child, last, frame.next == 1, frame.counters[s])) {
+                    if(last) matched = true;
+                    else addState(childframe.states, s + 1);
+                }
+            }
+            if(child.kind == SexpValueKind::SEXP && !child.value.sexp.empty() && !childframe.states.empty()) {
+                childframe.node = &child;
+                childframe.next = 0;
+                childframe.counters.assign(steps.size(), 0);
+                ++this->depth;
+            }
+            if(matched) return &child;
+        }
+        return nullptr;
+    }
+
+    auto SexpQueryMatches::begin() -> SexpQueryIterator {
+        return SexpQueryIterator{this, this->next()};
+    }
+
+    auto SexpQueryMatches::end() -> SexpQueryIterator {
+        return SexpQueryIterator{this, nullptr};
+    }
+
+    auto SexpQueryMatches::toVector() -> std::vector<Sexp*> {
+        auto result = std::vector<Sexp*>{};
+        for(auto match = this->next(); match != nullptr; match = this->next()) result.push_back(match);
+        return result;
+    }
+
+    auto SexpQueryIterator::operator*() const -> Sexp& { return *this->current; }
+
+    auto SexpQueryIterator::operator->() const -> Sexp* { return this->current; }
+
+    auto SexpQueryIterator::operator++() -> SexpQueryIterator& {
+        this->current = this->matches->next();
+        return *this;
+    }
+
+    auto SexpQueryIterator::operator==(SexpQueryIterator const& other) const -> bool { return this->current == other.current; }
+
+    auto SexpQueryIterator::operator!=(SexpQueryIterator const& other) const -> bool { return this->current != other.current; }
+
+    auto query(Sexp& root, SexpQuery const& query) -> SexpQueryMatches {
+        return SexpQueryMatches{root, query};
+    }
+
+    static auto predicatesEqual(SexpQueryPredicate const& a, SexpQueryPredicate const& b) -> bool {
+        if(a.kind != b.kind) return false;
+        switch(a.kind) {
+            case SexpQueryPredicateKind::POSITION: return a.position == b.position;
+            case SexpQueryPredicateKind::ATTRIBUTE: return a.attribute == b.attribute;
+            case SexpQueryPredicateKind::ATOMKIND: return a.atomkind == b.atomkind;
+            case SexpQueryPredicateKind::SEXPKIND: return a.sexpkind == b.sexpkind;
+            case SexpQueryPredicateKind::CHILD: return a.name == b.name;
+            case SexpQueryPredicateKind::CHILD_VALUE: return a.name == b.name && a.value == b.value;
+        }
+        return false;
+    }
+
+    static auto stepsEqual(SexpQueryStep const& a, SexpQueryStep const& b) -> bool {
+        return a.descendant == b.descendant && a.wildcard == b.wildcard && a.name == b.name
+            && a.predicates.size() == b.predicates.size()
+            && std::equal(a.predicates.begin(), a.predicates.end(), b.predicates.begin(), predicatesEqual);
+    }
+
+    SexpQueryBatch::SexpQueryBatch() {
+        this->nodes.resize(1);
+    }
+
+    auto SexpQueryBatch::size() const -> size_t {
+        return this->callbacks.size();
+    }
+
+    auto SexpQueryBatch::add(SexpQuery const& query, std::function<void(Sexp&)> callback) -> size_t {
+        auto id = this->callbacks.size();
+        this->callbacks.push_back(std::move(callback));
+        if(query.steps.empty()) return id;
+        uint32_t cur = 0;
+        for(size_t i = 0; i < query.steps.size(); ++i) {
+            auto& step = query.steps[i];
+            // a named step counts atoms towards its position only when it is
+            // the last step, so such steps are only shared at the same place
+            auto positional = std::any_of(step.predicates.begin(), step.predicates.end(), [](SexpQueryPredicate const& pred) {
+                return pred.kind == SexpQueryPredicateKind::POSITION;
+            });
+            auto last = positional && !step.wildcard && i + 1 == query.steps.size();
+            auto& children = this->nodes[cur].children;
+            auto found = std::find_if(children.begin(), children.end(), [this, &step, last](uint32_t idx) {
+                return this->nodes[idx].last == last && stepsEqual(this->nodes[idx].step, step);
+            });
+            if(found != children.end()) {
+                cur = *found;
+                continue;
+            }
+            auto next = static_cast<uint32_t>(this->nodes.size());
+            children.push_back(next);
+            this->nodes.push_back(Node{step, last, positional, {}, {}});
+            cur = next;
+        }
+        this->nodes[cur].queries.push_back(id);
+        return id;
+    }
+
+    static auto batchKey(Sexp const& node, bool head) -> std::string const* {
+        if(node.kind == SexpValueKind::ATOM) return head ? nullptr : &node.value.str;
+        if(!node.value.sexp.empty() && node.value.sexp[0].kind == SexpValueKind::ATOM) return &node.value.sexp[0].value.str;
+        return nullptr;
+    }
+
+    auto SexpQueryBatch::run(Sexp& root) -> void {
+        if(root.kind != SexpValueKind::SEXP) return;
+        this->named.clear();
+        this->wildcards.clear();
+        this->active.assign(this->nodes.size(), 0);
+
+        size_t depth = 0;
+        size_t livesteps = 0;
+        auto nextstates = std::vector<uint32_t>{};
+        auto candidates = std::vector<uint32_t>{};
+        auto enter = [this, &depth, &livesteps](Sexp* node, std::vector<uint32_t> const& states) {
+            if(this->frames.size() == depth) this->frames.emplace_back();
+            auto& frame = this->frames[depth++];
+            frame.node = node;
+            frame.next = 0;
+            frame.states.clear();
+            frame.live.clear();
+            frame.counters.clear();
+            for(auto s : states) {
+                auto& step = this->nodes[s].step;
+                if(!step.descendant) {
+                    frame.states.push_back(s);
+                    continue;
+                }
+                if(this->active[s]) continue;
+                this->active[s] = 1;
+                ++livesteps;
+                frame.live.push_back(s);
+                if(step.wildcard) this->wildcards.push_back(s);
+                else this->named[step.name].push_back(s);
+            }
+        };
+        auto leave = [this, &depth, &livesteps]() {
+            auto& frame = this->frames[--depth];
+            for(auto s : frame.live) {
+                this->active[s] = 0;
+                --livesteps;
+                auto& step = this->nodes[s].step;
+                auto& list = step.wildcard ? this->wildcards : this->named[step.name];
+                list.erase(std::find(list.begin(), list.end(), s));
+            }
+        };
+
+        enter(&root, this->nodes[0].children);
+        while(depth > 0) {
+            auto& frame = this->frames[depth - 1];
+            if(frame.next == frame.node->value.sexp.size()) {
+                leave();
+                continue;
+            }
+            auto head = frame.next == 0;
+            auto& child = frame.node->value.sexp[frame.next++];
+
+            candidates.clear();
+            candidates.insert(candidates.end(), frame.states.begin(), frame.states.end());
+            candidates.insert(candidates.end(), this->wildcards.begin(), this->wildcards.end());
+            auto key = batchKey(child, head);
+            if(key != nullptr) {
+                auto found = this->named.find(*key);
+                if(found != this->named.end()) candidates.insert(candidates.end(), found->second.begin(), found->second.end());
+            }
+
+            nextstates.clear();
+            for(auto s : candidates) {
+                auto& node = this->nodes[s];
+                size_t unused = 0;
+                auto counter = &unused;
+                if(node.positional) {
+                    auto found = std::find_if(frame.counters.begin(), frame.counters.end(), [s](std::pair<uint32_t, size_t> const& c) { return c.first == s; });
+                    if(found == frame.counters.end()) {
+                        frame.counters.emplace_back(s, 0);
+                        found = frame.counters.end() - 1;
+                    }
+                    counter = &found->second;
+                }
+                if(!queryStepMatches(node.step, child, !node.queries.empty(), head, *counter)) continue;
+                for(auto q : node.queries) this->callbacks[q](child);
+                for(auto c : node.children) addState(nextstates, c);
+            }
+
+            // live // steps must see every node below, so descend while any are live
+            if(child.kind == SexpValueKind::SEXP && !child.value.sexp.empty() && (livesteps != 0 || !nextstates.empty())) {
+                enter(&child, nextstates);
+            }
+        }
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef SEXPRESSO_QUERY_H
+#define SEXPRESSO_QUERY_H
+// XPath-like queries over Sexp trees.
+//
+//   defun/name          lists headed by name inside top level lists headed by defun
+//   //defun             lists headed by defun at any depth
+//   let/*               every child of top level let forms
+//   //b[2]              the second b of every list that has at least two
+//   //foo[@quote]       quoted foo forms; also backquote, funcquote, comma, atsplice, dotsplice
+//   //*[:string]        string atoms; also the other atom kinds, vector and complex
+//   //module[pad]       module lists with a child list headed by pad
+//   //pad[layer=F.Cu]   pad lists containing (layer F.Cu)
+//
+// As with getChildByPath, a name matches atoms only in the last step, and
+// never the head symbol of a list, which names the list itself.
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    enum class SexpQueryPredicateKind : uint8_t { POSITION, ATTRIBUTE, ATOMKIND, SEXPKIND, CHILD, CHILD_VALUE };
+
+    struct SexpQueryPredicate {
+        SexpQueryPredicateKind kind;
+        size_t position;            // POSITION, 1-based
+        SexpAttributeKind attribute; // ATTRIBUTE
+        SexpAtomKind atomkind;      // ATOMKIND
+        SexpSexpKind sexpkind;      // SEXPKIND
+        std::string name;           // CHILD, CHILD_VALUE
+        std::string value;          // CHILD_VALUE
+    };
+
+    struct SexpQueryStep {
+        bool descendant; // step was preceded by //
+        bool wildcard;
+        std::string name;
+        std::vector<SexpQueryPredicate> predicates; // applied in order, at most one POSITION
+    };
+
+    struct SexpQuery {
+        std::vector<SexpQueryStep> steps;
+    };
+
+    auto compileQuery(std::string const& query) -> SexpQuery;
+    auto compileQuery(std::string const& query, std::string& err) -> SexpQuery;
+
+    struct SexpQueryMatches;
+
+    struct SexpQueryIterator {
+        SexpQueryMatches* matches;
+        Sexp* current;
+
+        auto operator*() const -> Sexp&;
+        auto operator->() const -> Sexp*;
+        auto operator++() -> SexpQueryIterator&;
+        auto operator==(SexpQueryIterator const& other) const -> bool;
+        auto operator!=(SexpQueryIterator const& other) const -> bool;
+    };
+
+    // Lazily walks the tree once, evaluating every step of the query as it
+    // goes, and yields matches in document order. Single pass only.
+    struct SexpQueryMatches {
+        SexpQueryMatches(Sexp& root, SexpQuery const& query);
+
+        auto next() -> Sexp*; // nullptr when done
+        auto begin() -> SexpQueryIterator;
+        auto end() -> SexpQueryIterator;
+        auto toVector() -> std::vector<Sexp*>;
+
+        struct Frame {
+            Sexp* node;
+            size_t next;
+            std::vector<uint32_t> states;  // steps that apply to this node's children
+            std::vector<size_t> counters;  // per step, for positional predicates
+        };
+        SexpQuery query;
+        std::vector<Frame> frames; // reused between levels to avoid allocating
+        size_t depth;
+    };
+
+    auto query(Sexp& root, SexpQuery const& query) -> SexpQueryMatches;
+
+    // Runs many queries in one pre-order walk. Queries are merged into a trie
+    // of steps so common prefixes are evaluated once, and live // steps are
+    // looked up by name, so a node is only tested against the steps that can
+    // match it. Each query's callback sees its matches in document order.
+    struct SexpQueryBatch {
+        SexpQueryBatch();
+        auto add(SexpQuery const& query, std::function<void(Sexp&)> callback) -> size_t; // query id
+        auto run(Sexp& root) -> void;
+        auto size() const -> size_t;
+
+        struct Node {
+            SexpQueryStep step;
+            bool last;                     // only set for steps whose position predicate depends on it
+            bool positional;
+            std::vector<size_t> queries;   // queries ending here
+            std::vector<uint32_t> children;
+        };
+        struct Frame {
+            Sexp* node;
+            size_t next;
+            std::vector<uint32_t> states;  // child steps that apply to this node's children
+            std::vector<uint32_t> live;    // // steps this node made live for its subtree
+            std::vector<std::pair<uint32_t, size_t>> counters;
+        };
+        std::vector<Node> nodes; // nodes[0] is the root and has no step
+        std::vector<std::function<void(Sexp&)>> callbacks;
+        std::vector<Frame> frames;
+        std::unordered_map<std::string, std::vector<uint32_t>> named; // live // steps by name
+        std::vector<uint32_t> wildcards;                                // live // steps named *
+        std::vector<char> active; // per node, whether its // step is live
+    };
+}
+#endif
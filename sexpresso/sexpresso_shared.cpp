@@ -0,0 +1,379 @@
+// Hash-consed immutable sexpresso trees
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cctype>
+#include "sexpresso.hpp"
+#include "sexpresso_shared.hpp"
+#include "sexpresso_internal.hpp"
+
+namespace sexpresso {
+
+    auto SexpNode::childCount() const -> size_t {
+        return this->children.size();
+    }
+
+    auto SexpNode::getChild(size_t idx) const -> SexpRef const& {
+        return this->children[idx];
+    }
+
+    auto SexpNode::isString() const -> bool {
+        return this->kind == SexpValueKind::ATOM;
+    }
+
+    auto SexpNode::isSexp() const -> bool {
+        return this->kind == SexpValueKind::SEXP;
+    }
+
+    auto SexpNode::toSexp() const -> Sexp {
+        auto sexp = Sexp{};
+        sexp.kind = this->kind;
+        sexp.sexpkind = this->sexpkind;
+        sexp.atomkind = this->atomkind;
+        sexp.attributes = this->attributes;
+        sexp.dotted = this->dotted;
+        sexp.value.str = this->str;
+        sexp.value.sexp.reserve(this->children.size());
+        for(auto const& child : this->children) sexp.value.sexp.push_back(child->toSexp());
+        return sexp;
+    }
+
+    auto SexpNode::toString(SexpressoPrintMode printmode) const -> std::string {
+        return this->toSexp().toString(printmode);
+    }
+
+    static auto nodeHash(SexpNode const& node) -> uint64_t {
+        return structuralHash(node, node.str, node.children, [](SexpRef const& child) { return child->hash; });
+    }
+
+    // Children are already interned, so comparing them by pointer is enough.
+    static auto sameNode(SexpNode const& a, SexpNode const& b) -> bool {
+        return a.kind == b.kind && a.sexpkind == b.sexpkind && a.atomkind == b.atomkind && a.dotted == b.dotted
+            && a.attributes == b.attributes && a.str == b.str && a.children == b.children;
+    }
+
+    auto toShared(Sexp const& sexp) -> SexpRef {
+        auto node = SexpNode{};
+        node.kind = sexp.kind;
+        node.sexpkind = sexp.sexpkind;
+        node.atomkind = sexp.atomkind;
+        node.attributes = sexp.attributes;
+        node.dotted = sexp.dotted;
+        switch(sexp.kind) {
+            case SexpValueKind::SEXP:
+                node.children.reserve(sexp.value.sexp.size());
+                for(auto const& child : sexp.value.sexp) node.children.push_back(toShared(child));
+                break;
+            case SexpValueKind::ATOM:
+                node.str = sexp.value.str;
+                break;
+        }
+        node.hash = nodeHash(node);
+        return std::make_shared<SexpNode const>(std::move(node));
+    }
+
+    namespace {
+        struct LabelReader {
+            std::unordered_map<std::string, SexpRef> labels; // by "#n"
+            std::unordered_set<std::string> open; // labels whose form is being read
+            std::string& err;
+
+            static auto label(Sexp const& sexp, char end) -> bool {
+                auto& str = sexp.value.str;
+                return sexp.kind == SexpValueKind::ATOM && str.size() > 2 && str[0] == '#' && str.back() == end
+                    && std::isdigit(static_cast<unsigned char>(str[1]));
+            }
+
+            // Attributes read before a label, as in '#1=(x), quote the labeled
+            // form, but #1# still refers to the form itself.
+            static auto withAttributes(SexpRef const& ref, std::vector<SexpAttributeKind> const& attributes) -> SexpRef {
+                if(attributes.empty()) return ref;
+                auto node = *ref;
+                node.attributes.insert(node.attributes.begin(), attributes.begin(), attributes.end());
+                node.hash = nodeHash(node);
+                return std::make_shared<SexpNode const>(std::move(node));
+            }
+
+            auto read(Sexp& sexp) -> SexpRef {
+                if(sexp.kind == SexpValueKind::ATOM) return toShared(sexp);
+                auto node = SexpNode{};
+                node.kind = SexpValueKind::SEXP;
+                node.sexpkind = sexp.sexpkind;
+                node.atomkind = SexpAtomKind::NONE;
+                node.attributes = sexp.attributes;
+                node.dotted = sexp.dotted;
+                node.children.reserve(sexp.value.sexp.size());
+                auto& children = sexp.value.sexp;
+                for(size_t i = 0; i < children.size(); ++i) {
+                    auto& child = children[i];
+                    if(label(child, '=')) {
+                        auto name = child.value.str.substr(0, child.value.str.size() - 1);
+                        if(i + 1 == children.size()) {
+                            this->err = "label " + child.value.str + " is not followed by a form";
+                            return nullptr;
+                        }
+                        if(this->labels.count(name) != 0 || this->open.count(name) != 0) {
+                            this->err = "label " + child.value.str + " is defined twice";
+                            return nullptr;
+                        }
+                        this->open.insert(name);
+                        auto ref = this->read(children[++i]);
+                        if(ref == nullptr) return nullptr;
+                        this->open.erase(name);
+                        this->labels.emplace(name, ref);
+                        node.children.push_back(withAttributes(ref, child.attributes));
+                        continue;
+                    }
+                    if(label(child, '#')) {
+                        auto name = child.value.str.substr(0, child.value.str.size() - 1);
+                        auto found = this->labels.find(name);
+                        if(found == this->labels.end()) {
+                            this->err = "label " + child.value.str + (this->open.count(name) != 0 ? " is used inside its own form, cycles are not supported" : " is not defined");
+                            return nullptr;
+                        }
+                        node.children.push_back(withAttributes(found->second, child.attributes));
+                        continue;
+                    }
+                    auto ref = this->read(child);
+                    if(ref == nullptr) return nullptr;
+                    node.children.push_back(std::move(ref));
+                }
+                std::vector<Sexp>{}.swap(sexp.value.sexp);
+                node.hash = nodeHash(node);
+                return std::make_shared<SexpNode const>(std::move(node));
+            }
+        };
+
+        struct LabelWriter {
+            std::unordered_map<SexpNode const*, size_t> uses;
+            std::unordered_map<SexpNode const*, size_t> labels;
+            std::string out;
+
+            static auto labelable(SexpNode const& node) -> bool {
+                return node.kind == SexpValueKind::SEXP ? !node.children.empty() : node.atomkind == SexpAtomKind::STRING;
+            }
+
+            auto count(SexpNode const& node) -> void {
+                if(++this->uses[&node] > 1) return;
+                for(auto const& child : node.children) this->count(*child);
+            }
+
+            auto write(SexpNode const& node, SexpressoPrintMode printmode) -> void {
+                if(this->uses[&node] > 1 && labelable(node)) {
+                    auto found = this->labels.find(&node);
+                    if(found != this->labels.end()) {
+                        this->out += "#" + std::to_string(found->second) + "#";
+                        return;
+                    }
+                    auto label = this->labels.size() + 1;
+                    this->labels.emplace(&node, label);
+                    this->out += "#" + std::to_string(label) + "=";
+                }
+                if(node.kind == SexpValueKind::ATOM) {
+                    this->out += node.toString();
+                    return;
+                }
+                for(auto attribute : node.attributes) this->out += attributePrefix(attribute);
+                this->out += sexpKindPrefix(node.sexpkind);
+                auto parens = printmode == SexpressoPrintMode::TOP_LEVEL_PARENS;
+                if(parens) this->out.push_back('(');
+                for(size_t i = 0; i < node.children.size(); ++i) {
+                    if(i != 0) this->out += node.dotted && i + 1 == node.children.size() ? " . " : " ";
+                    this->write(*node.children[i], SexpressoPrintMode::TOP_LEVEL_PARENS);
+                }
+                if(parens) this->out.push_back(')');
+            }
+        };
+    }
+
+    auto parseLabeled(std::string const& str, std::string& err) -> SexpRef {
+        auto options = SexpParseOptions{};
+        options.labels = true;
+        auto sexp = sexpresso::parse(str, err, options);
+        if(!err.empty()) return nullptr;
+        auto reader = LabelReader{{}, {}, err};
+        return reader.read(sexp);
+    }
+
+    auto toLabeledString(SexpRef const& root, SexpressoPrintMode printmode) -> std::string {
+        auto writer = LabelWriter{};
+        writer.count(*root);
+        writer.write(*root, printmode);
+        return std::move(writer.out);
+    }
+
+    // Same matching as Sexp::getChildByPath: a segment names the list it
+    // heads, and atoms only match the last segment.
+    static auto resolvePath(SexpNode const& root, SexpPath const& path, std::vector<size_t>& indices) -> bool {
+        if(root.kind != SexpValueKind::SEXP || path.segments.empty()) return false;
+        auto cur = &root;
+        for(size_t i = 0; i < path.segments.size(); ++i) {
+            auto last = i == path.segments.size() - 1;
+            auto& name = path.segments[i];
+            auto found = std::find_if(cur->children.begin(), cur->children.end(), [&name, last](SexpRef const& child) {
+                if(child->kind == SexpValueKind::ATOM) return last && child->str == name;
+                return !child->children.empty() && child->children[0]->kind == SexpValueKind::ATOM && child->children[0]->str == name;
+            });
+            if(found == cur->children.end()) return false;
+            indices.push_back(static_cast<size_t>(found - cur->children.begin()));
+            cur = found->get();
+        }
+        return true;
+    }
+
+    auto SexpNode::getChildByPath(SexpPath const& path) const -> SexpRef {
+        auto indices = std::vector<size_t>{};
+        if(!resolvePath(*this, path, indices)) return nullptr;
+        auto cur = this->children[indices[0]];
+        for(size_t i = 1; i < indices.size(); ++i) cur = cur->children[indices[i]];
+        return cur;
+    }
+
+    enum class PathEdit { REPLACE, INSERT, REMOVE };
+
+    // Copies node and its descendants along path, editing the list that holds
+    // the last index; everything off the path is shared.
+    static auto editPath(SexpNode const& node, std::vector<size_t> const& path, size_t depth, PathEdit edit, SexpRef const& child) -> SexpRef {
+        if(node.kind != SexpValueKind::SEXP) return nullptr;
+        auto idx = path[depth];
+        auto limit = edit == PathEdit::INSERT && depth + 1 == path.size() ? node.children.size() + 1 : node.children.size();
+        if(idx >= limit) return nullptr;
+        auto copy = node;
+        if(depth + 1 < path.size()) {
+            auto edited = editPath(*node.children[idx], path, depth + 1, edit, child);
+            if(!edited) return nullptr;
+            copy.children[idx] = std::move(edited);
+        } else {
+            switch(edit) {
+                case PathEdit::REPLACE:
+                    copy.children[idx] = child;
+                    break;
+                case PathEdit::INSERT:
+                    copy.children.insert(copy.children.begin() + static_cast<std::ptrdiff_t>(idx), child);
+                    break;
+                case PathEdit::REMOVE:
+                    copy.children.erase(copy.children.begin() + static_cast<std::ptrdiff_t>(idx));
+                    break;
+            }
+        }
+        copy.hash = nodeHash(copy);
+        return std::make_shared<SexpNode const>(std::move(copy));
+    }
+
+    auto SexpNode::with(std::vector<size_t> const& path, SexpRef child) const -> SexpRef {
+        if(!child) return nullptr;
+        if(path.empty()) return child;
+        return editPath(*this, path, 0, PathEdit::REPLACE, child);
+    }
+
+    auto SexpNode::with(SexpPath const& path, SexpRef child) const -> SexpRef {
+        auto indices = std::vector<size_t>{};
+        if(!resolvePath(*this, path, indices)) return nullptr;
+        return this->with(indices, std::move(child));
+    }
+
+    auto SexpNode::withInserted(std::vector<size_t> const& path, SexpRef child) const -> SexpRef {
+        if(!child || path.empty()) return nullptr;
+        return editPath(*this, path, 0, PathEdit::INSERT, child);
+    }
+
+    auto SexpNode::without(std::vector<size_t> const& path) const -> SexpRef {
+        if(path.empty()) return nullptr;
+        return editPath(*this, path, 0, PathEdit::REMOVE, nullptr);
+    }
+
+    auto SexpInterner::insert(SexpNode node) -> SexpRef {
+        node.hash = nodeHash(node);
+        auto& bucket = this->table[node.hash];
+        for(auto const& ref : bucket) {
+            if(sameNode(*ref, node)) return ref;
+        }
+        bucket.push_back(std::make_shared<SexpNode const>(std::move(node)));
+        ++this->count;
+        return bucket.back();
+    }
+
+    auto SexpInterner::intern(Sexp const& sexp) -> SexpRef {
+        auto node = SexpNode{};
+        node.kind = sexp.kind;
+        node.sexpkind = sexp.sexpkind;
+        node.atomkind = sexp.atomkind;
+        node.attributes = sexp.attributes;
+        node.dotted = sexp.dotted;
+        switch(sexp.kind) {
+            case SexpValueKind::SEXP:
+                node.children.reserve(sexp.value.sexp.size());
+                for(auto const& child : sexp.value.sexp) node.children.push_back(this->intern(child));
+                break;
+            case SexpValueKind::ATOM:
+                node.str = sexp.value.str;
+                break;
+        }
+        return this->insert(std::move(node));
+    }
+
+    auto SexpInterner::atom(std::string const& str, SexpAtomKind atomkind, std::vector<SexpAttributeKind> attributes) -> SexpRef {
+        auto node = SexpNode{};
+        node.kind = SexpValueKind::ATOM;
+        node.sexpkind = SexpSexpKind::NONE;
+        node.atomkind = atomkind;
+        node.attributes = std::move(attributes);
+        node.str = escape(str);
+        return this->insert(std::move(node));
+    }
+
+    auto SexpInterner::list(std::vector<SexpRef> children, SexpSexpKind sexpkind, std::vector<SexpAttributeKind> attributes, bool dotted) -> SexpRef {
+        auto node = SexpNode{};
+        node.kind = SexpValueKind::SEXP;
+        node.sexpkind = sexpkind;
+        node.atomkind = SexpAtomKind::NONE;
+        node.attributes = std::move(attributes);
+        node.dotted = dotted;
+        node.children = std::move(children);
+        return this->insert(std::move(node));
+    }
+
+    // Interns bottom-up and frees each list of the parse tree once it has
+    // been interned, so the two trees are not both fully alive at the end.
+    static auto internConsuming(SexpInterner& interner, Sexp& sexp) -> SexpRef {
+        if(sexp.kind == SexpValueKind::ATOM) return interner.intern(sexp);
+        auto children = std::vector<SexpRef>{};
+        children.reserve(sexp.value.sexp.size());
+        for(auto& child : sexp.value.sexp) children.push_back(internConsuming(interner, child));
+        std::vector<Sexp>{}.swap(sexp.value.sexp);
+        return interner.list(std::move(children), sexp.sexpkind, sexp.attributes, sexp.dotted);
+    }
+
+    auto SexpInterner::parse(std::string const& str, std::string& err) -> SexpRef {
+        auto sexp = sexpresso::parse(str, err);
+        return internConsuming(*this, sexp);
+    }
+
+    auto SexpInterner::size() const -> size_t {
+        return this->count;
+    }
+
+    auto SexpInterner::collect() -> size_t {
+        size_t removed = 0;
+        // dropping a node can leave its children unreferenced, so go again
+        // until nothing changes
+        for(auto changed = true; changed;) {
+            changed = false;
+            for(auto it = this->table.begin(); it != this->table.end();) {
+                auto& bucket = it->second;
+                auto before = bucket.size();
+                bucket.erase(std::remove_if(bucket.begin(), bucket.end(), [](SexpRef const& ref) { return ref.use_count() == 1; }), bucket.end());
+                removed += before - bucket.size();
+                changed = changed || before != bucket.size();
+                if(bucket.empty()) it = this->table.erase(it);
+                else ++it;
+            }
+        }
+        this->count -= removed;
+        return removed;
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef SEXPRESSO_SHARED_H
+#define SEXPRESSO_SHARED_H
+// Immutable, reference counted trees. A SexpInterner hands out one SexpNode
+// per distinct content, so identical subtrees are stored once and the result
+// of interning a tree is a DAG. Two nodes from the same interner have equal
+// content exactly when they are the same pointer.
+//
+//   sexpresso::SexpInterner interner;
+//   auto board = interner.parse(str, err);
+//   auto layer = interner.intern(sexpresso::parse("(layer F.Cu)").getChild(0));
+//   if(board->getChild(0)->getChild(2) == layer) ...
+//
+// Nodes are never changed. with(), withInserted() and without() return a new
+// root that copies only the nodes on the path to the edit and shares every
+// other subtree with the old version, so both versions stay readable:
+//
+//   auto v2 = v1->with(sexpresso::SexpPath{"board/layer"}, sexpresso::toShared(newlayer));
+//
+// Common Lisp's #n= and #n# labels read into shared nodes, and shared nodes
+// print back with labels instead of being expanded:
+//
+//   auto dump = sexpresso::parseLabeled("(#1=(big form) #1# #1#)", err);
+//   dump->getChild(0)->getChild(0) == dump->getChild(0)->getChild(1) // same node
+//   sexpresso::toLabeledString(dump) == "(#1=(big form) #1# #1#)"
+//
+// Shared nodes have no positions, dirty flag or index, since a node can sit
+// in many places. An interner is not thread safe; the nodes it returns, and
+// nodes made by toShared() and the edits, can be read from any thread.
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    struct SexpNode;
+    using SexpRef = std::shared_ptr<const SexpNode>;
+
+    struct SexpNode {
+        SexpValueKind kind;
+        SexpSexpKind sexpkind;
+        SexpAtomKind atomkind;
+        std::vector<SexpAttributeKind> attributes;
+        std::string str; // atoms, escaped like Sexp::value.str
+        std::vector<SexpRef> children; // lists
+        uint64_t hash; // same as Sexp::hash() of the same content
+        bool dotted; // as Sexp::dotted
+
+        auto childCount() const -> size_t;
+        auto getChild(size_t idx) const -> SexpRef const&;
+        auto isString() const -> bool;
+        auto isSexp() const -> bool;
+        auto toSexp() const -> Sexp; // expands shared subtrees into copies
+        auto toString(SexpressoPrintMode printmode = SexpressoPrintMode::NO_TOPLEVEL_PARENS) const -> std::string;
+        auto getChildByPath(SexpPath const& path) const -> SexpRef; // as Sexp::getChildByPath, nullptr if not found
+
+        // Path copying edits, nullptr if the path does not fit. Paths are child
+        // indices from this node; edits through interned nodes are not interned.
+        auto with(std::vector<size_t> const& path, SexpRef child) const -> SexpRef; // an empty path gives child
+        auto with(SexpPath const& path, SexpRef child) const -> SexpRef; // replaces what getChildByPath finds
+        auto withInserted(std::vector<size_t> const& path, SexpRef child) const -> SexpRef; // last index may be childCount()
+        auto without(std::vector<size_t> const& path) const -> SexpRef;
+    };
+
+    auto toShared(Sexp const& sexp) -> SexpRef; // copies without interning
+
+    // Labels are document wide. Nodes are not interned, so only labeled forms
+    // are shared. A label used inside its own form would make a cycle, which
+    // immutable nodes cannot hold, and is reported as an error. nullptr on error.
+    auto parseLabeled(std::string const& str, std::string& err) -> SexpRef;
+    // Lists with children and strings reached more than once, by pointer, get
+    // #n= where first printed and #n# after that.
+    auto toLabeledString(SexpRef const& root, SexpressoPrintMode printmode = SexpressoPrintMode::NO_TOPLEVEL_PARENS) -> std::string;
+
+    struct SexpInterner {
+        auto intern(Sexp const& sexp) -> SexpRef;
+        auto atom(std::string const& str, SexpAtomKind atomkind = SexpAtomKind::SYMBOL, std::vector<SexpAttributeKind> attributes = {}) -> SexpRef;
+        auto list(std::vector<SexpRef> children, SexpSexpKind sexpkind = SexpSexpKind::NONE, std::vector<SexpAttributeKind> attributes = {}, bool dotted = false) -> SexpRef;
+        auto parse(std::string const& str, std::string& err) -> SexpRef; // the parse tree is freed as it is interned
+        auto size() const -> size_t; // distinct nodes held
+        auto insert(SexpNode node) -> SexpRef; // node's children must come from this interner
+        auto collect() -> size_t; // forgets nodes only the interner still refers to, returns how many
+
+        std::unordered_map<uint64_t, std::vector<SexpRef>> table; // by SexpNode::hash
+        size_t count = 0;
+    };
+}
+#endif
@@ -0,0 +1,97 @@
+// Atomically published shared sexpresso trees
+#include <array>
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "sexpresso.hpp"
+#include "sexpresso_shared.hpp"
+#include "sexpresso_store.hpp"
+
+namespace sexpresso {
+
+    // Each thread sticks to one stripe, handed out round robin
+    static auto threadStripe() -> size_t {
+        static std::atomic<size_t> threads{0};
+        thread_local size_t stripe = threads.fetch_add(1, std::memory_order_relaxed);
+        return stripe;
+    }
+
+    SexpStore::SexpStore() : SexpStore(SexpRef{}) {
+        this->versions = 0;
+    }
+
+    SexpStore::SexpStore(SexpRef root) : root(new SexpRef(std::move(root))), epoch(0), versions(1) {
+        for(auto& stripe : this->stripes) {
+            stripe.readers[0] = 0;
+            stripe.readers[1] = 0;
+        }
+    }
+
+    SexpStore::~SexpStore() {
+        delete this->root.load();
+    }
+
+    auto SexpStore::load() const -> SexpRef {
+        auto result = SexpRef{};
+        this->read([&result, this](SexpNode const*) { result = *this->root.load(); });
+        return result;
+    }
+
+    auto SexpStore::read(std::function<void(SexpNode const*)> const& f) const -> void {
+        auto& stripe = this->stripes[threadStripe() % this->stripes.size()];
+        auto parity = this->epoch.load() & 1;
+        ++stripe.readers[parity];
+        struct Leave {
+            std::atomic<uint64_t>& readers;
+            ~Leave() { readers.fetch_sub(1, std::memory_order_release); }
+        } leave{stripe.readers[parity]};
+        f(this->root.load()->get());
+    }
+
+    // Once the root is swapped, the old one can only still be seen by readers
+    // counted in before the swap. They may have read the epoch before either
+    // of the last two flips, so flip twice and drain the old parity each time;
+    // readers arriving meanwhile count in on the other one and are not waited for.
+    auto SexpStore::waitForReaders() -> void {
+        for(int flip = 0; flip < 2; ++flip) {
+            auto parity = this->epoch.fetch_add(1) & 1;
+            for(auto& stripe : this->stripes) {
+                while(stripe.readers[parity].load() != 0) std::this_thread::yield();
+            }
+        }
+    }
+
+    auto SexpStore::publish(SexpRef root) -> void {
+        auto old = this->root.exchange(new SexpRef(std::move(root)));
+        ++this->versions;
+        this->waitForReaders();
+        delete old; // frees the old version unless a snapshot still holds it
+    }
+
+    auto SexpStore::store(SexpRef root) -> void {
+        std::lock_guard<std::mutex> lock(this->writer);
+        this->publish(std::move(root));
+    }
+
+    auto SexpStore::update(std::function<SexpRef(SexpRef const&)> const& f) -> SexpRef {
+        auto current = this->load();
+        while(true) {
+            auto next = f(current);
+            if(!next) return nullptr;
+            std::lock_guard<std::mutex> lock(this->writer);
+            auto latest = *this->root.load(); // only writers swap it, and we are the writer
+            if(latest == current) {
+                this->publish(next);
+                return next;
+            }
+            current = std::move(latest);
+        }
+    }
+
+    auto SexpStore::version() const -> uint64_t {
+        return this->versions;
+    }
+}
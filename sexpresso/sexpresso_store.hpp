@@ -0,0 +1,64 @@
+#ifndef SEXPRESSO_STORE_H
+#define SEXPRESSO_STORE_H
+// Holds the current version of a shared tree for many reader threads.
+//
+//   sexpresso::SexpStore config{sexpresso::toShared(sexpresso::parse(text))};
+//   auto snapshot = config.load();            // readers: never lock or wait
+//   config.read([](sexpresso::SexpNode const* root) { ... }); // same, without a copy
+//   config.store(sexpresso::toShared(newtree)); // reload: readers keep their snapshot
+//   config.update([](sexpresso::SexpRef const& cur) { return cur->with(path, child); });
+//
+// Reads are wait-free, in the manner of RCU: a reader counts itself in on
+// one of a few striped counters, each on its own cache line, loads the
+// published root and counts itself out again. Writers are serialized among
+// themselves, swap in the new root and then wait for the readers counted in
+// before the swap to leave before freeing the old pointer, which only ever
+// takes as long as a pointer copy. load() still bumps the reference count of
+// the tree it returns, which all its readers share; read() does not.
+// A snapshot stays valid for as long as the reader holds it, and the old
+// version is freed when the last reader lets go.
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include "sexpresso.hpp"
+#include "sexpresso_shared.hpp"
+
+namespace sexpresso {
+    struct SexpStore {
+        SexpStore();
+        explicit SexpStore(SexpRef root);
+        ~SexpStore();
+        SexpStore(SexpStore const&) = delete;
+        SexpStore& operator=(SexpStore const&) = delete;
+
+        auto load() const -> SexpRef;
+        // Calls f with the current root, or nullptr, without copying it.
+        // Writers wait for f to return before they finish publishing, so keep
+        // it short and load() a snapshot to hold on to a version.
+        auto read(std::function<void(SexpNode const*)> const& f) const -> void;
+        auto store(SexpRef root) -> void;
+        // Builds a new version from the current one and publishes it unless
+        // another writer got there first, in which case it tries again on that
+        // version. Returns what was published, or nullptr if f returned nullptr.
+        auto update(std::function<SexpRef(SexpRef const&)> const& f) -> SexpRef;
+        auto version() const -> uint64_t; // number of versions published
+
+    private:
+        struct Stripe {
+            std::atomic<uint64_t> readers[2]; // readers inside, by epoch parity
+            char padding[64 - 2 * sizeof(std::atomic<uint64_t>)]; // a cache line each
+        };
+        auto publish(SexpRef root) -> void;
+        auto waitForReaders() -> void;
+
+        std::mutex writer; // serializes store() and update(), readers never take it
+        std::atomic<SexpRef const*> root;
+        std::atomic<uint64_t> epoch;
+        mutable std::array<Stripe, 32> stripes;
+        std::atomic<uint64_t> versions;
+    };
+}
+#endif
@@ -0,0 +1,137 @@
+// Non-recursive traversals of sexpresso::Sexp trees
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include "sexpresso.hpp"
+#include "sexpresso_walk.hpp"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define SEXPRESSO_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define SEXPRESSO_PREFETCH(addr) ((void)(addr))
+#endif
+
+namespace sexpresso {
+
+    static auto hasChildren(Sexp const& sexp) -> bool {
+        return sexp.kind == SexpValueKind::SEXP && !sexp.value.sexp.empty();
+    }
+
+    // The children of the sibling after idx live in their own allocation;
+    // start loading them while the caller works on the current node.
+    static auto prefetchSibling(Sexp const& list, size_t idx) -> void {
+        if(idx + 1 < list.value.sexp.size()) SEXPRESSO_PREFETCH(list.value.sexp[idx + 1].value.sexp.data());
+    }
+
+    SexpWalk::SexpWalk(Sexp& root, SexpWalkOrder order) : order(order), current{&root, nullptr, 0, 0}, started(false), skip(false) {}
+
+    auto SexpWalk::next() -> Sexp* {
+        if(!this->started) {
+            this->started = true;
+            if(this->order != SexpWalkOrder::POSTORDER) return this->current.node;
+            if(hasChildren(*this->current.node)) this->stack.push_back(Frame{this->current.node, 0});
+            else return this->current.node;
+        } else if(this->current.node == nullptr) {
+            return nullptr;
+        }
+
+        switch(this->order) {
+            case SexpWalkOrder::PREORDER:
+                if(!this->skip && hasChildren(*this->current.node)) this->stack.push_back(Frame{this->current.node, 0});
+                this->skip = false;
+                while(!this->stack.empty()) {
+                    auto& frame = this->stack.back();
+                    if(frame.next == frame.node->value.sexp.size()) {
+                        this->stack.pop_back();
+                        continue;
+                    }
+                    auto idx = frame.next++;
+                    prefetchSibling(*frame.node, idx);
+                    this->current = Entry{&frame.node->value.sexp[idx], frame.node, idx, this->stack.size()};
+                    return this->current.node;
+                }
+                break;
+
+            case SexpWalkOrder::POSTORDER:
+                while(!this->stack.empty()) {
+                    auto& frame = this->stack.back();
+                    if(frame.next == frame.node->value.sexp.size()) {
+                        auto node = frame.node;
+                        this->stack.pop_back();
+                        if(this->stack.empty()) this->current = Entry{node, nullptr, 0, 0};
+                        else this->current = Entry{node, this->stack.back().node, this->stack.back().next - 1, this->stack.size()};
+                        return node;
+                    }
+                    auto idx = frame.next++;
+                    auto& child = frame.node->value.sexp[idx];
+                    prefetchSibling(*frame.node, idx);
+                    if(hasChildren(child)) {
+                        this->stack.push_back(Frame{&child, 0});
+                        continue;
+                    }
+                    this->current = Entry{&child, frame.node, idx, this->stack.size()};
+                    return &child;
+                }
+                break;
+
+            case SexpWalkOrder::BREADTH_FIRST:
+                if(!this->skip && hasChildren(*this->current.node)) {
+                    auto node = this->current.node;
+                    for(size_t i = 0; i < node->value.sexp.size(); ++i) {
+                        this->queue.push_back(Entry{&node->value.sexp[i], node, i, this->current.depth + 1});
+                    }
+                }
+                this->skip = false;
+                if(!this->queue.empty()) {
+                    this->current = this->queue.front();
+                    this->queue.pop_front();
+                    if(!this->queue.empty()) SEXPRESSO_PREFETCH(this->queue.front().node->value.sexp.data());
+                    return this->current.node;
+                }
+                break;
+        }
+        this->current = Entry{nullptr, nullptr, 0, 0};
+        return nullptr;
+    }
+
+    auto SexpWalk::begin() -> SexpWalkIterator {
+        return SexpWalkIterator{this, this->next()};
+    }
+
+    auto SexpWalk::end() -> SexpWalkIterator {
+        return SexpWalkIterator{this, nullptr};
+    }
+
+    auto SexpWalk::depth() const -> size_t { return this->current.depth; }
+
+    auto SexpWalk::parent() const -> Sexp* { return this->current.parent; }
+
+    auto SexpWalk::childIndex() const -> size_t { return this->current.index; }
+
+    auto SexpWalk::skipChildren() -> void { this->skip = true; }
+
+    auto SexpWalkIterator::operator*() const -> Sexp& { return *this->current; }
+
+    auto SexpWalkIterator::operator->() const -> Sexp* { return this->current; }
+
+    auto SexpWalkIterator::operator++() -> SexpWalkIterator& {
+        this->current = this->walk->next();
+        return *this;
+    }
+
+    auto SexpWalkIterator::operator==(SexpWalkIterator const& other) const -> bool { return this->current == other.current; }
+
+    auto SexpWalkIterator::operator!=(SexpWalkIterator const& other) const -> bool { return this->current != other.current; }
+
+    auto preorder(Sexp& root) -> SexpWalk {
+        return SexpWalk{root, SexpWalkOrder::PREORDER};
+    }
+
+    auto postorder(Sexp& root) -> SexpWalk {
+        return SexpWalk{root, SexpWalkOrder::POSTORDER};
+    }
+
+    auto breadthFirst(Sexp& root) -> SexpWalk {
+        return SexpWalk{root, SexpWalkOrder::BREADTH_FIRST};
+    }
+}
@@ -0,0 +1,69 @@
+#ifndef SEXPRESSO_WALK_H
+#define SEXPRESSO_WALK_H
+// Non-recursive walks over a Sexp tree, for input too deep to recurse over.
+//
+//   auto walk = sexpresso::preorder(sexp);
+//   for(auto& node : walk) {
+//       if(walk.depth() > 2) walk.skipChildren();
+//   }
+//
+// Each walk visits the node it was started on too, at depth 0 with no parent.
+// Don't add or remove children of lists the walk has not finished with.
+
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include "sexpresso.hpp"
+
+namespace sexpresso {
+    enum class SexpWalkOrder : uint8_t { PREORDER, POSTORDER, BREADTH_FIRST };
+
+    struct SexpWalk;
+
+    struct SexpWalkIterator {
+        SexpWalk* walk;
+        Sexp* current;
+
+        auto operator*() const -> Sexp&;
+        auto operator->() const -> Sexp*;
+        auto operator++() -> SexpWalkIterator&;
+        auto operator==(SexpWalkIterator const& other) const -> bool;
+        auto operator!=(SexpWalkIterator const& other) const -> bool;
+    };
+
+    struct SexpWalk {
+        SexpWalk(Sexp& root, SexpWalkOrder order = SexpWalkOrder::PREORDER);
+
+        auto next() -> Sexp*; // nullptr when done
+        auto begin() -> SexpWalkIterator;
+        auto end() -> SexpWalkIterator;
+
+        // About the node last returned by next()
+        auto depth() const -> size_t;
+        auto parent() const -> Sexp*; // nullptr for the root
+        auto childIndex() const -> size_t; // position in the parent, 0 for the head
+        auto skipChildren() -> void; // don't visit its descendants; post-order has already visited them
+
+        struct Frame {
+            Sexp* node;
+            size_t next;
+        };
+        struct Entry {
+            Sexp* node;
+            Sexp* parent;
+            size_t index;
+            size_t depth;
+        };
+        SexpWalkOrder order;
+        Entry current;
+        bool started;
+        bool skip;
+        std::vector<Frame> stack;  // pre-order and post-order
+        std::deque<Entry> queue;   // breadth-first
+    };
+
+    auto preorder(Sexp& root) -> SexpWalk;
+    auto postorder(Sexp& root) -> SexpWalk;
+    auto breadthFirst(Sexp& root) -> SexpWalk;
+}
+#endif